@@ -0,0 +1,198 @@
+/*
+* bench - times quickerd's parse and write phases over description files
+* Released under           :: GPL v3
+*
+* usage: bench [-n runs] [-c commit] [-o results.json] file...
+*
+* every file is measured in a child process of its own so the peak RSS
+* belongs to that file alone. allocations are counted by linking with
+* -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc (see the Makefile);
+* quickerd.c itself is compiled in, minus its main.
+* results are printed as a table and written as json to -o.
+*/
+
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define QUICKERD_NO_MAIN
+#include "../quickerd.c"
+
+struct bench_result_t {
+    long bytes, lines;
+    double parse_ms, write_ms;
+    long parse_allocs, write_allocs;
+    long parse_alloc_bytes, write_alloc_bytes;
+    long peak_rss_kb;
+    int ok;
+};
+
+typedef struct bench_result_t bench_result;
+
+/* allocation counters, bumped by the wrappers below */
+static long n_allocs, alloc_bytes;
+
+void *__real_malloc(size_t sz);
+void *__real_calloc(size_t n, size_t sz);
+void *__real_realloc(void *p, size_t sz);
+
+void *__wrap_malloc(size_t sz)
+{
+    n_allocs++;
+    alloc_bytes += sz;
+    return __real_malloc(sz);
+}
+
+void *__wrap_calloc(size_t n, size_t sz)
+{
+    n_allocs++;
+    alloc_bytes += n*sz;
+    return __real_calloc(n, sz);
+}
+
+void *__wrap_realloc(void *p, size_t sz)
+{
+    n_allocs++;
+    alloc_bytes += sz;
+    return __real_realloc(p, sz);
+}
+
+double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* best of runs for one file, run in the child */
+void measure(const char *file, const char *outfile, int runs, bench_result *res)
+{
+    gv_opts opt;
+    int r;
+
+    memset(res, 0, sizeof(bench_result));
+    res->parse_ms = res->write_ms = -1;
+
+    for (r=0; r<runs; r++) {
+        char *mem = read_file_into_mem(file);
+        char *p;
+        double t0, t1, tw, t2;
+
+        if (!mem) return;
+
+        if (!r) {
+            for (p = mem; *p != EOF; p++) {
+                res->bytes++;
+                if (*p == '\n') res->lines++;
+            }
+        }
+
+        n_allocs = alloc_bytes = 0;
+        t0 = now_ms();
+        node **table = parse_content(mem);
+        t1 = now_ms();
+        res->parse_allocs = n_allocs;
+        res->parse_alloc_bytes = alloc_bytes;
+        free(mem);
+        if (!table) return;
+
+        memset(&opt, 0, sizeof(opt));
+        opt.force = true;
+        unlink(outfile);    /* write_gv_output asks before overwriting */
+        n_allocs = alloc_bytes = 0;
+        tw = now_ms();
+        write_gv_output(table, (char *)outfile, &opt);
+        t2 = now_ms();
+        res->write_allocs = n_allocs;
+        res->write_alloc_bytes = alloc_bytes;
+        freemem(table);
+
+        /* keep the best run, the others are noise from the machine */
+        if (res->parse_ms < 0 || t1-t0 < res->parse_ms) res->parse_ms = t1-t0;
+        if (res->write_ms < 0 || t2-tw < res->write_ms) res->write_ms = t2-tw;
+    }
+    unlink(outfile);
+    res->ok = 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *commit = "unknown", *json = NULL;
+    int runs = 3, i, nfiles = 0;
+
+    for (i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "-n") && i+1 < argc) runs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c") && i+1 < argc) commit = argv[++i];
+        else if (!strcmp(argv[i], "-o") && i+1 < argc) json = argv[++i];
+        else break;
+    }
+    nfiles = argc - i;
+    if (!nfiles || runs < 1) {
+        fprintf(stderr, "Usage: %s [-n runs] [-c commit] [-o results.json] file...\n", argv[0]);
+        return 1;
+    }
+    char **files = argv + i;
+
+    bench_result *res = calloc(nfiles, sizeof(bench_result));
+    if (!res) { perror("calloc"); return 1; }
+
+    char outfile[64];
+    snprintf(outfile, sizeof(outfile), "/tmp/quickerd-bench-%d.gv", (int)getpid());
+
+    printf("%-28s %9s %9s %9s %8s %8s %10s %10s %9s\n", "file", "lines", "parse ms", "write ms",
+           "parse MB/s", "lines/s", "p.allocs", "w.allocs", "rss KB");
+    for (i=0; i<nfiles; i++) {
+        int fd[2];
+        if (pipe(fd)) { perror("pipe"); return 1; }
+        fflush(stdout);
+
+        pid_t pid = fork();
+        if (pid < 0) { perror("fork"); return 1; }
+        if (!pid) {
+            bench_result r;
+            struct rusage ru;
+            close(fd[0]);
+            measure(files[i], outfile, runs, &r);
+            getrusage(RUSAGE_SELF, &ru);
+            r.peak_rss_kb = ru.ru_maxrss;
+            write(fd[1], &r, sizeof(r));
+            _exit(0);
+        }
+        close(fd[1]);
+        if (read(fd[0], &res[i], sizeof(bench_result)) != sizeof(bench_result))
+            res[i].ok = 0;
+        close(fd[0]);
+        waitpid(pid, NULL, 0);
+
+        bench_result *r = &res[i];
+        if (!r->ok) {
+            printf("%-28s failed\n", files[i]);
+            continue;
+        }
+        printf("%-28s %9ld %9.2f %9.2f %10.1f %8.0f %10ld %10ld %9ld\n", files[i], r->lines,
+               r->parse_ms, r->write_ms, r->bytes / 1048576.0 / (r->parse_ms / 1e3),
+               r->lines / ((r->parse_ms + r->write_ms) / 1e3),
+               r->parse_allocs, r->write_allocs, r->peak_rss_kb);
+    }
+
+    if (json) {
+        FILE *fp = fopen(json, "w");
+        if (!fp) { perror("fopen"); return 1; }
+        fprintf(fp, "{\n  \"commit\": \"%s\",\n  \"runs\": %d,\n  \"results\": [\n", commit, runs);
+        for (i=0; i<nfiles; i++) {
+            bench_result *r = &res[i];
+            fprintf(fp, "    {\"file\": \"%s\", \"ok\": %s, \"bytes\": %ld, \"lines\": %ld, "
+                        "\"parse_ms\": %.3f, \"write_ms\": %.3f, "
+                        "\"parse_allocs\": %ld, \"parse_alloc_bytes\": %ld, "
+                        "\"write_allocs\": %ld, \"write_alloc_bytes\": %ld, \"peak_rss_kb\": %ld}%s\n",
+                    files[i], r->ok ? "true" : "false", r->bytes, r->lines, r->parse_ms, r->write_ms,
+                    r->parse_allocs, r->parse_alloc_bytes, r->write_allocs, r->write_alloc_bytes,
+                    r->peak_rss_kb, i+1 < nfiles ? "," : "");
+        }
+        fprintf(fp, "  ]\n}\n");
+        fclose(fp);
+    }
+
+    free(res);
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+* gen_erd - writes synthetic ERD description files for benchmarking quickerd
+* Released under           :: GPL v3
+*
+* usage: gen_erd [options] > erd.txt
+*   -l lines     approximate number of lines, sets -t accordingly
+*   -t tables    number of table specs (default 100)
+*   -c cols      columns per table (default 8)
+*   -r rels      relationships per table (default 1.0)
+*   -v vars      variables defined up front (default 64)
+*   -u density   fraction of table references made through a variable (default 0.2)
+*   -k ratio     comment/blank lines per spec line (default 0.1)
+*   -8 ratio     fraction of column names spelled in UTF-8 (default 0)
+*   -s seed      random seed (default 1)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct gen_opts_t {
+    long lines, tables;
+    int cols, vars;
+    double rels, var_use, comments, utf8;
+    unsigned long seed;
+};
+
+typedef struct gen_opts_t gen_opts;
+
+/* small, fast and the same on every platform, unlike rand() */
+unsigned long next_rand(unsigned long *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+double next_unit(unsigned long *state)
+{
+    return (next_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void maybe_comment(gen_opts *opt, unsigned long *state)
+{
+    double c = opt->comments;
+
+    while (c > 0) {
+        if (c < 1 && next_unit(state) >= c) break;
+        if (next_rand(state) & 1)
+            printf("# generated filler comment\n");
+        else
+            printf("\n");
+        c -= 1;
+    }
+}
+
+/* table name, or the variable standing for it */
+void print_table_ref(gen_opts *opt, long t, unsigned long *state)
+{
+    if (t < opt->vars && next_unit(state) < opt->var_use)
+        printf("v_%ld", t);
+    else
+        printf("table_%ld", t);
+}
+
+int main(int argc, char **argv)
+{
+    gen_opts opt = { 0, 100, 8, 64, 1.0, 0.2, 0.1, 0, 1 };
+    int i;
+
+    for (i=1; i+1<argc; i+=2) {
+        if (!strcmp(argv[i], "-l")) opt.lines = atol(argv[i+1]);
+        else if (!strcmp(argv[i], "-t")) opt.tables = atol(argv[i+1]);
+        else if (!strcmp(argv[i], "-c")) opt.cols = atoi(argv[i+1]);
+        else if (!strcmp(argv[i], "-r")) opt.rels = atof(argv[i+1]);
+        else if (!strcmp(argv[i], "-v")) opt.vars = atoi(argv[i+1]);
+        else if (!strcmp(argv[i], "-u")) opt.var_use = atof(argv[i+1]);
+        else if (!strcmp(argv[i], "-k")) opt.comments = atof(argv[i+1]);
+        else if (!strcmp(argv[i], "-8")) opt.utf8 = atof(argv[i+1]);
+        else if (!strcmp(argv[i], "-s")) opt.seed = strtoul(argv[i+1], NULL, 10);
+        else break;
+    }
+    if (i < argc || opt.tables < 1 || opt.cols < 1 || opt.vars < 0) {
+        fprintf(stderr, "Usage: %s [-l lines] [-t tables] [-c cols] [-r rels] [-v vars] [-u density] [-k ratio] [-8 ratio] [-s seed]\n", argv[0]);
+        return 1;
+    }
+    if (opt.lines) {
+        /* every table brings its spec, its relationships and their filler */
+        opt.tables = (opt.lines - opt.vars) / ((1 + opt.rels) * (1 + opt.comments));
+        if (opt.tables < 1) opt.tables = 1;
+    }
+    if (opt.vars > opt.tables) opt.vars = opt.tables;
+
+    unsigned long state = opt.seed ? opt.seed : 1;
+    long t;
+    int c;
+
+    for (i=0; i<opt.vars; i++)
+        printf("v_%d : table_%d\n", i, i);
+
+    for (t=0; t<opt.tables; t++) {
+        maybe_comment(&opt, &state);
+        print_table_ref(&opt, t, &state);
+        printf("(id");
+        for (c=1; c<opt.cols; c++) {
+            /* latin, greek and CJK, two to four bytes a letter */
+            static const char *utf8[] = { "größe", "café", "μήκος", "名前", "日付" };
+            if (opt.utf8 > 0 && next_unit(&state) < opt.utf8)
+                printf(",%s_%d_%ld", utf8[next_rand(&state) % 5], c, next_rand(&state) % 1000);
+            else
+                printf(",col_%d_%ld", c, next_rand(&state) % 1000);
+        }
+        printf(")\n");
+    }
+
+    double r = opt.rels * opt.tables;
+    static const char card[] = "1mn";
+    for (; r >= 1 || (r > 0 && next_unit(&state) < r); r -= 1) {
+        maybe_comment(&opt, &state);
+        print_table_ref(&opt, next_rand(&state) % opt.tables, &state);
+        printf(" > ");
+        print_table_ref(&opt, next_rand(&state) % opt.tables, &state);
+        printf(", rel %ld, %c:%c\n", (long)(next_rand(&state) % 100),
+               card[next_rand(&state) % 3], card[next_rand(&state) % 3]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+* gen_hostile - writes description files shaped to hit quickerd's worst cases
+* Released under           :: GPL v3
+*
+* usage: gen_hostile case n > erd.txt
+*   long_line     one table whose column name is n bytes long
+*   wide_table    one table with n columns
+*   dup_columns   one table with n columns of the same name
+*   dup_tables    n tables of the same name, each with the same column
+*   var_collide   n variables whose names all start the same probe chain
+*   many_rels     n tables, each related to the one before it
+*
+* bench/guard runs quickerd over each of them with a time and memory budget.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void long_line(long n)
+{
+    long i;
+
+    printf("t(id,");
+    for (i=0; i<n; i++)
+        putchar('a' + i % 26);
+    printf(")\n");
+}
+
+void wide_table(long n)
+{
+    long i;
+
+    printf("t(id");
+    for (i=1; i<n; i++)
+        printf(",c%ld", i);
+    printf(")\n");
+}
+
+void dup_columns(long n)
+{
+    long i;
+
+    printf("t(id");
+    for (i=1; i<n; i++)
+        printf(",c");
+    printf(")\n");
+}
+
+void dup_tables(long n)
+{
+    long i;
+
+    for (i=0; i<n; i++)
+        printf("t(c)\n");
+}
+
+/* quickerd's hash_str, keep the two the same */
+unsigned long long hash_str(const char *key)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    int c;
+
+    while ( (c = (unsigned char)*key++) ) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/*
+ * quickerd's variable table starts at 1024 slots and doubles to keep
+ * itself at most half full. names whose hashes agree in every bit the
+ * final mask keeps land on the same slot at every size, so each lookup
+ * walks all the names before it. found by counting through names, about
+ * as many tries per name as the table has slots.
+ */
+void var_collide(long n)
+{
+    char name[16] = "v", (*names)[16] = malloc(n * sizeof(*names));
+    long sz, i, found = 0;
+    unsigned long long want = 0;
+    int len = 2, k;
+
+    if (!names) { perror("malloc"); exit(1); }
+    for (sz = 1024; (n+1)*2 > sz; sz *= 2)
+        ;
+    name[1] = 'a';
+    while (found < n) {
+        unsigned long long h = hash_str(name) & (sz-1);
+        if (!found) want = h;
+        if (h == want)
+            memcpy(names[found++], name, sizeof(name));
+
+        /* next name: v followed by letters, counted like digits */
+        for (k=len-1; k>0 && name[k] == 'z'; k--)
+            name[k] = 'a';
+        if (k)
+            name[k]++;
+        else
+            name[len++] = 'a';
+    }
+    for (i=0; i<n; i++)
+        printf("%s : table_%ld\n", names[i], i);
+    /* and use every one of them */
+    for (i=0; i<n; i++)
+        printf("%s(id)\n", names[i]);
+    free(names);
+}
+
+void many_rels(long n)
+{
+    long i;
+
+    for (i=0; i<n; i++)
+        printf("table_%ld(id,name)\n", i);
+    for (i=1; i<n; i++)
+        printf("table_%ld > table_%ld, rel %ld, m:1\n", i, i-1, i);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        void (*gen)(long n);
+    } cases[] = {
+        { "long_line", long_line },
+        { "wide_table", wide_table },
+        { "dup_columns", dup_columns },
+        { "dup_tables", dup_tables },
+        { "var_collide", var_collide },
+        { "many_rels", many_rels },
+    };
+    int i, ncases = sizeof(cases) / sizeof(cases[0]);
+    long n = argc == 3 ? atol(argv[2]) : 0;
+
+    for (i=0; argc == 3 && n > 0 && i<ncases; i++)
+        if (!strcmp(argv[1], cases[i].name)) {
+            cases[i].gen(n);
+            return 0;
+        }
+
+    fprintf(stderr, "Usage: %s case n\ncases:", argv[0]);
+    for (i=0; i<ncases; i++)
+        fprintf(stderr, " %s", cases[i].name);
+    fprintf(stderr, "\n");
+    return 1;
+}
@@ -0,0 +1,133 @@
+/*
+* guard - runs quickerd over the gen_hostile shapes within time and memory budgets
+* Released under           :: GPL v3
+*
+* usage: guard [-q quickerd] [-g gen_hostile] [-d dir]
+*
+* every case is sized so that a quadratic path takes minutes where a
+* linear one takes well under a second, so the budgets can be loose and
+* still fail on a regression. var_collide is quadratic by design, its
+* names all share one probe chain; it bounds what a probe costs. exits 1
+* if any case fails or runs over.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+struct guard_case_t {
+    const char *name;
+    long n;
+    const char *flag;   /* extra quickerd option, or NULL */
+    double max_ms;
+    long max_rss_kb;
+};
+
+static const struct guard_case_t cases[] = {
+    { "long_line",   8000000, NULL,        2000,  200000 },
+    { "wide_table",   500000, NULL,        3000,  250000 },
+    { "wide_table",   500000, "--compact", 3000,  250000 },
+    { "dup_columns",  500000, NULL,        3000,  250000 },
+    { "dup_tables",   200000, NULL,        3000,  160000 },
+    { "var_collide",   10000, NULL,        3000,  150000 },
+    { "many_rels",    200000, NULL,        6000,  400000 },
+    { "many_rels",    200000, "--compact", 6000,  400000 },
+};
+
+double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * runs argv with stdout to out (unless NULL) and at most cpu_s seconds of
+ * cpu (unless 0), so a quadratic run is cut short. returns its exit
+ * status, -1 if it was killed.
+ */
+int run(char **argv, const char *out, long cpu_s, double *ms, long *rss_kb)
+{
+    struct rusage ru;
+    int status;
+    double t0 = now_ms();
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) { perror("fork"); exit(1); }
+    if (!pid) {
+        if (cpu_s) {
+            struct rlimit rl = { cpu_s, cpu_s };
+            setrlimit(RLIMIT_CPU, &rl);
+        }
+        if (out) {
+            int fd = open(out, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+            if (fd < 0 || dup2(fd, 1) < 0) _exit(127);
+            close(fd);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    if (wait4(pid, &status, 0, &ru) < 0) { perror("wait4"); exit(1); }
+    if (ms) *ms = now_ms() - t0;
+    if (rss_kb) *rss_kb = ru.ru_maxrss;
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(int argc, char **argv)
+{
+    char *quickerd = "./quickerd", *gen = "bench/gen_hostile", *dir = "bench/data";
+    int i, failed = 0, ncases = sizeof(cases) / sizeof(cases[0]);
+
+    for (i=1; i+1<argc; i+=2) {
+        if (!strcmp(argv[i], "-q")) quickerd = argv[i+1];
+        else if (!strcmp(argv[i], "-g")) gen = argv[i+1];
+        else if (!strcmp(argv[i], "-d")) dir = argv[i+1];
+        else break;
+    }
+    if (i < argc) {
+        fprintf(stderr, "Usage: %s [-q quickerd] [-g gen_hostile] [-d dir]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-12s %9s %-10s %9s %9s %10s %10s\n", "case", "n", "option", "ms", "budget", "rss KB", "budget");
+    for (i=0; i<ncases; i++) {
+        const struct guard_case_t *c = &cases[i];
+        char in[512], out[512], n[32];
+        double ms;
+        long rss;
+
+        snprintf(in, sizeof(in), "%s/hostile_%s_%ld.txt", dir, c->name, c->n);
+        snprintf(out, sizeof(out), "%s/hostile_%s.gv", dir, c->name);
+        snprintf(n, sizeof(n), "%ld", c->n);
+
+        char *gen_argv[] = { gen, (char *)c->name, n, NULL };
+        if (access(in, R_OK) && run(gen_argv, in, 0, NULL, NULL)) {
+            printf("%-12s could not be generated\n", c->name);
+            unlink(in);
+            failed++;
+            continue;
+        }
+
+        char *q_argv[] = { quickerd, "-f", c->flag ? (char *)c->flag : in, c->flag ? in : out,
+                           c->flag ? out : NULL, NULL };
+        int status = run(q_argv, NULL, c->max_ms / 1000 * 4 + 1, &ms, &rss);
+        int ok = !status && ms <= c->max_ms && rss <= c->max_rss_kb;
+
+        printf("%-12s %9ld %-10s %9.0f %9.0f %10ld %10ld  %s\n", c->name, c->n, c->flag ? c->flag : "",
+               ms, c->max_ms, rss, c->max_rss_kb,
+               status < 0 ? "KILLED" : status ? "FAILED" : ok ? "ok" : "OVER BUDGET");
+        if (!ok) failed++;
+        unlink(out);
+    }
+
+    if (failed)
+        printf("%d of %d cases failed\n", failed, ncases);
+    return failed ? 1 : 0;
+}
@@ -25,23 +25,55 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <regex.h>
+#include <time.h>
 #include <sys/types.h>
 
 #ifdef __linux
     #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+    #include <pthread.h>
+    #include <signal.h>
+    #include <stdint.h>
 #elif _WIN32
     #include <windows.h>
 #endif
 
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
 #define MEM_CHUNK 32
-#define HTAB_MAX 1024
+#define MEM_PAD 16                      /* zero bytes after the EOF mark, see line_span */
+#define HTAB_SIZE 1024                  /* first size of the variable table, a power of two */
 #define OUTBUFF_CHUNK 1024
 #define MAX_ERR_LEN 256
+#define REGEX_CACHE 8
+#define POOL_CHUNK 65536
+#define SERVE_CACHE 256                 /* answers kept by --serve */
+#define SERVE_EVENTS 64
+#define SERVE_MAX_REQUEST (64L << 20)
+#define SERVE_WORKERS 4
+#define LOAD_THREADS 8      /* included files scanned at once */
+#define SQL_CHUNK 65536     /* --sql reads the dump this much at a time */
+#define SQL_MAX_STMT (4L << 20)
+#define SQL_WORD_MAX 255
+#define INFER_DRAW 1        /* --infer: guessed relationships drawn dashed */
+#define INFER_LINES 2       /* --infer=lines: written as description lines */
+#define NEW_NODE_GAP 72.0   /* points between a new node and its neighbour */
 
-enum type { TB_SPEC, REL_SPEC };
+enum type { TB_SPEC, REL_SPEC, VAR_SPEC, INC_SPEC };   /* the last two only before linking */
+enum diff_state { DIFF_SAME, DIFF_ADDED, DIFF_REMOVED, DIFF_CHANGED };
 
 struct node_t {
     char *name, *uname;
@@ -56,28 +88,138 @@ struct var_decl_record {
 typedef struct node_t node;
 typedef struct var_decl_record var_record;
 
+struct layout_pins_t;
+
+/* knobs for write_gv_output */
+struct gv_opts_t {
+    int *elided;    /* per row: relationships left out by --focus, or NULL */
+    bool compact;   /* short ids and edge sets instead of one line per edge */
+    int *layer;     /* per row: rank layer of a table, -1 for relationships */
+    char *back;     /* per row: relationship closes a cycle */
+    int *bundle_lead, *bundle_next;     /* per row, see bundle_rels */
+    struct layout_pins_t *pins;         /* --layout-from positions, or NULL */
+    char *inferred; /* per row: relationship guessed by --infer, drawn dashed */
+    char **diff;    /* per row and node: DIFF_ state from --diff, or NULL */
+    bool force;     /* replace an existing output file without asking */
+};
+
+typedef struct gv_opts_t gv_opts;
+
+/* --stats counters. qstats stays NULL otherwise and nothing is measured */
+struct run_stats_t {
+    long read_bytes;
+    long lines, line_utf8;
+    long classify_calls;
+    long split_calls;
+    long var_lookups, var_probes;
+    long uname_lookups;
+    long fmt_calls, fmt_reallocs, fmt_bytes;
+    long write_calls, write_bytes;
+    double read_ns, line_ns, classify_ns, split_ns, uname_ns, fmt_ns, write_ns;
+    double parse_ns, output_ns;
+};
+
+struct run_stats_t *qstats = NULL;
+
+#define THREAD_LOCAL __thread
+
+#define STAT_ADD(field, n) do { if (qstats) qstats->field += (n); } while (0)
+#define STAT_START(t) double t = qstats ? stat_clock() : 0
+#define STAT_STOP(field, t) do { if (qstats) qstats->field += stat_clock() - (t); } while (0)
+
+double stat_clock(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+#else
+    return clock() * (1e9 / CLOCKS_PER_SEC);
+#endif
+}
+
 int hndl_fatal_error(const char* func)
 {
     perror(func);
     exit(1);
 }
 
+/* the whole output is gathered here and written out in one go */
+struct out_buf_t {
+    char *data;
+    size_t len, size;
+};
+
+typedef struct out_buf_t out_buf;
+
+void out_write(const void *buff, size_t count, out_buf *ob);
+
+/* errors in the input go to stderr, or to err_sink when --serve answers a request */
+THREAD_LOCAL out_buf *err_sink = NULL;
+
+void qerr(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    if (err_sink) {
+        char msg[MAX_ERR_LEN*4];
+        int n = vsnprintf(msg, sizeof(msg), fmt, ap);
+        if (n > (int)sizeof(msg)-1) n = sizeof(msg)-1;
+        if (n > 0) out_write(msg, n, err_sink);
+    }
+    else
+        vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+/* line grammar, shared by parse_content and check_content */
+/* \200-\377: names may be UTF-8, lines are checked to be well-formed by line_span */
+const char *reg_var_decl = "^[a-zA-Z0-9 _.\200-\377]+:[a-zA-Z0-9 _.\200-\377]+$";
+const char *reg_table_spec = "^[a-zA-Z0-9 _.^(\200-\377]+\\([a-zA-Z0-9, _.\200-\377]+\\)$";
+const char *reg_rel_spec = "^[a-zA-Z0-9 ._\200-\377]+>[a-zA-Z0-9 ._\200-\377]+,[a-zA-Z0-9 ._()\200-\377]+,[ ]*[1mnMN]{1}[ ]*:[ ]*[1mnMN]{1}[ ]*$";
+const char *reg_include = "^include +[^ ]";
+
 int handle_regex(char *text, const char *to_match, const int nmatch)
 {
-    regex_t reg_comp;
-    int status = regcomp(&reg_comp, to_match, REG_EXTENDED|REG_NEWLINE);
+    /* patterns are compiled once, keyed by the pattern pointer */
+    static struct {
+        const char *pattern;
+        regex_t comp;
+    } cache[REGEX_CACHE];
+    static int ncached = 0;
 
-    if (status) {
-        char err_msg[MAX_ERR_LEN];
-        regerror(status, &reg_comp, err_msg, MAX_ERR_LEN);
-        return 0;
+    STAT_START(t0);
+    STAT_ADD(classify_calls, 1);
+    regex_t reg_comp, *comp = NULL;
+    int k;
+
+    for (k=0; k<ncached; k++)
+        if (cache[k].pattern == to_match)
+            { comp = &cache[k].comp; break; }
+
+    if (!comp) {
+        int status = regcomp(&reg_comp, to_match, REG_EXTENDED|REG_NEWLINE);
+
+        if (status) {
+            char err_msg[MAX_ERR_LEN];
+            regerror(status, &reg_comp, err_msg, MAX_ERR_LEN);
+            return 0;
+        }
+        comp = &reg_comp;
+        if (ncached < REGEX_CACHE) {
+            cache[ncached].pattern = to_match;
+            cache[ncached].comp = reg_comp;
+            comp = &cache[ncached++].comp;
+        }
     }
 
     char *tmp = text;
     regmatch_t tmp_match[3];
 
-    int res = regexec(&reg_comp, tmp, 2, tmp_match, 0);
-    regfree(&reg_comp);
+    int res = regexec(comp, tmp, 2, tmp_match, 0);
+    if (comp == &reg_comp)
+        regfree(&reg_comp);
+    STAT_STOP(classify_ns, t0);
     return !res;
     /*
     int if_match=0, offset=0;
@@ -100,47 +242,144 @@ int handle_regex(char *text, const char *to_match, const int nmatch)
     */
 }
 
+/* compile the line patterns up front, before threads can race on the cache */
+void warm_regex(void)
+{
+    handle_regex("", reg_include, 0);
+    handle_regex("", reg_var_decl, 0);
+    handle_regex("", reg_table_spec, 0);
+    handle_regex("", reg_rel_spec, 0);
+}
+
 char *read_file_into_mem(const char *infile)
 {
   FILE *fp;
+  STAT_START(t0);
 
   if ( (fp = fopen(infile, "r")) ) {
     fseek(fp, 0L, SEEK_END);
     long bytes = ftell(fp);
     rewind(fp);
+    if (bytes < 0) {    /* a directory, say */
+      qerr("Can't read %s: %s\n", infile, strerror(errno));
+      fclose(fp);
+      return NULL;
+    }
 
-    char *mem = malloc(bytes * sizeof(char) +1);
+    char *mem = malloc(bytes * sizeof(char) +2 +MEM_PAD);
     if(!mem) hndl_fatal_error("malloc");
 
-    fread(mem, 1, bytes, fp);
+    bytes = fread(mem, 1, bytes, fp);
     fclose(fp);
 
     *(mem+bytes) = EOF;
+    memset(mem+bytes+1, 0, MEM_PAD+1);    /* for string functions */
+    STAT_ADD(read_bytes, bytes);
+    STAT_STOP(read_ns, t0);
     return mem;
   }
-  else
-    hndl_fatal_error("fopen");
+
+  /* a bad include mustn't take a --serve daemon down with it */
+  qerr("Can't read %s: %s\n", infile, strerror(errno));
+  return NULL;
+}
+
+/*
+ * UTF-8. the length of the well-formed sequence at s, 0 for anything
+ * else: ASCII, a stray continuation byte, overlong forms, surrogates and
+ * code points past U+10FFFF. it reads no further than the first byte
+ * that doesn't fit, so a terminator stops it like any other.
+ */
+int utf8_seq(const unsigned char *s, const unsigned char *end)
+{
+    unsigned char c = s[0];
+    int n, k;
+
+    if (c < 0xC2 || c > 0xF4) return 0;
+    n = c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+    if (end && end - s < n) return 0;
+    for (k=1; k<n; k++)
+        if ((s[k] & 0xC0) != 0x80) return 0;
+    if ((c == 0xE0 && s[1] < 0xA0) || (c == 0xED && s[1] > 0x9F) ||
+        (c == 0xF0 && s[1] < 0x90) || (c == 0xF4 && s[1] > 0x8F))
+        return 0;
+    return n;
+}
+
+/* true if the SCAN_BLOCK bytes at s are all printable ASCII */
+#ifdef __SSE2__
+#define SCAN_BLOCK 16
+
+bool ascii_block(const unsigned char *s)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)s);
+    __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1F)),
+                               _mm_cmplt_epi8(v, _mm_set1_epi8(0x7F)));  /* signed: >= 0x80 fails */
+    return _mm_movemask_epi8(ok) == 0xFFFF;
+}
+#else
+#define SCAN_BLOCK 8
+
+bool ascii_block(const unsigned char *s)
+{
+    const unsigned long long ones = 0x0101010101010101ULL, high = ones << 7;
+    unsigned long long x, del;
+
+    memcpy(&x, s, 8);
+    del = x ^ (ones * 0x7F);
+    return !((x & high) |                       /* >= 0x80 */
+             ((x - ones*0x20) & ~x & high) |    /* < 0x20 */
+             ((del - ones) & ~del & high));     /* 0x7F */
+}
+#endif
+
+/*
+ * bytes of the line at line: printable ASCII and well-formed UTF-8, up
+ * to '\n' or the first byte that is neither. runs of ASCII are checked a
+ * block at a time. without end, line is in the read_file_into_mem layout
+ * and at or before its EOF mark; the MEM_PAD bytes after the mark keep
+ * the last block readable.
+ */
+size_t line_span(const char *line, const char *end)
+{
+    const unsigned char *s = (const unsigned char *)line, *e = (const unsigned char *)end;
+    int n;
+
+    for (;;) {
+        while ((!e || e - s >= SCAN_BLOCK) && ascii_block(s))
+            s += SCAN_BLOCK;
+        if (e && s >= e)
+            break;
+        if (*s >= 0x20 && *s < 0x7F)
+            s++;
+        else if ((n = utf8_seq(s, e))) {
+            s += n;
+            STAT_ADD(line_utf8, 1);
+        }
+        else
+            break;
+    }
+    return s - (const unsigned char *)line;
 }
 
 /* get each line from memory as they appear in the file */
 char *getline_from_mem(char **looper)
 {
-  int indx=0;
+  size_t indx;
   char *temp=NULL;
+  STAT_START(t0);
+  STAT_ADD(lines, 1);
 
-  /* allocate in units of MEM_CHUNK */
-  if (!(temp = malloc(MEM_CHUNK))) hndl_fatal_error("malloc");
-  size_t tot_alloc = MEM_CHUNK;
-  while(**looper && **looper != '\n' && isprint(**looper))
-  {
-    if(! ((indx+1) % MEM_CHUNK) )/* +2 to accommodate null byte */
-    { temp = realloc(temp, tot_alloc+MEM_CHUNK); tot_alloc += MEM_CHUNK; }
-    temp[indx++] = *((*looper)++);
-  }
+  indx = line_span(*looper, NULL);
+  if (!(temp = malloc(indx+2))) hndl_fatal_error("malloc");
+  memcpy(temp, *looper, indx);
+  *looper += indx;
   if (indx == 0 && **looper != EOF) temp[indx++] = '#';
   temp[indx] = '\0';
 
-  (*looper)++; /* point to next line */
+  if (**looper != EOF)
+    (*looper)++; /* point to next line; the last one may have no '\n' */
+  STAT_STOP(line_ns, t0);
   return temp;
 }
 
@@ -173,7 +412,9 @@ void chop_leadntrail (char *str, int sz)
 
 char *split(char *str, char *delim, bool reset)
 {
-    static int j=0;
+    static THREAD_LOCAL int j=0;  /* --serve parses on several threads */
+    STAT_START(t0);
+    STAT_ADD(split_calls, 1);
     if (reset) j=0;
     int len = strlen(delim);
     int i=0;
@@ -202,84 +443,260 @@ char *split(char *str, char *delim, bool reset)
         if (stop) break;
         tmp++;
     }
-    if (!i) { j=0; return NULL; }
+    if (!i) { j=0; STAT_STOP(split_ns, t0); return NULL; }
     char *substr = calloc(i+2, sizeof(char));
     strncpy(substr, str+j, i);
     j += i;
     chop_leadntrail(substr, i);
+    STAT_STOP(split_ns, t0);
     return substr;
 }
 
-int get_index (var_record **vrec, int sz, char *var, int *dup_at)
+/* string -> int map with open addressing; keys are borrowed, not copied */
+struct name_index_t {
+    char **keys;
+    int *vals;
+    int size, count;    /* size is always a power of two */
+};
+
+typedef struct name_index_t name_index;
+
+/*
+ * FNV-1a, then mixed so that the low bits used as a slot depend on every
+ * byte. djb2 had families of equal-length names hashing alike ("Ez" and
+ * "FY" and every string made of them), which piled into one probe run.
+ * bench/gen_hostile has a copy to search for names that still collide.
+ */
+unsigned long hash_str(const char *key)
 {
-    unsigned long hash = 5381;
-    char *key = var;
+    unsigned long long hash = 14695981039346656037ULL;
     int c;
 
-    while (c = *key++)
-        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    while ( (c = (unsigned char)*key++) ) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
 
-    hash &= 0x0000EFFF;
-    int indx = hash % sz;
-    int orig_indx = indx;
+    return hash;
+}
 
-    if ( vrec[indx] ) {
-        /* open addressing */
-        for (indx; indx < sz; indx++) {
-            if (! vrec[indx] ) break;
-            if (! strcmp(vrec[indx]->var, var) )
-                { *dup_at = indx; return -1; }
-        }
+void nidx_init(name_index *ni, int hint)
+{
+    ni->size = MEM_CHUNK;
+    while (ni->size < hint*2)
+        ni->size <<= 1;
+    ni->count = 0;
+    ni->keys = calloc(ni->size, sizeof(char *));
+    ni->vals = calloc(ni->size, sizeof(int));
+    if (!ni->keys || !ni->vals)
+        hndl_fatal_error("calloc");
+}
+
+int nidx_slot(name_index *ni, const char *key)
+{
+    int mask = ni->size-1;
+    int i = hash_str(key) & mask;
+
+    while (ni->keys[i] && strcmp(ni->keys[i], key))
+        i = (i+1) & mask;
+
+    return i;
+}
+
+/* returns the value already stored under key, or -1 after inserting val */
+int nidx_insert(name_index *ni, char *key, int val)
+{
+    if ((ni->count+1)*2 > ni->size) {
+        name_index grown;
+        int i;
+
+        nidx_init(&grown, ni->size);
+        for (i=0; i<ni->size; i++)
+            if (ni->keys[i])
+                nidx_insert(&grown, ni->keys[i], ni->vals[i]);
+        free(ni->keys);
+        free(ni->vals);
+        *ni = grown;
+    }
+
+    int slot = nidx_slot(ni, key);
+    if (ni->keys[slot])
+        return ni->vals[slot];
+
+    ni->keys[slot] = key;
+    ni->vals[slot] = val;
+    ni->count++;
+    return -1;
+}
+
+int nidx_lookup(name_index *ni, const char *key)
+{
+    int slot = nidx_slot(ni, key);
+    return ni->keys[slot] ? ni->vals[slot] : -1;
+}
+
+void nidx_free(name_index *ni)
+{
+    free(ni->keys);
+    free(ni->vals);
+    ni->keys = NULL;
+    ni->vals = NULL;
+}
+
+/* the value stored under key, which must be in ni, becomes val */
+void nidx_set(name_index *ni, const char *key, int val)
+{
+    ni->vals[nidx_slot(ni, key)] = val;
+}
+
+/*
+ * the variable table: open addressing over a power of two of slots,
+ * doubled by make_entry once half of them are taken
+ */
+int get_index (var_record **vrec, int sz, char *var, int *dup_at)
+{
+    int mask = sz-1;
+    int indx = hash_str(var) & mask;
+    STAT_ADD(var_lookups, 1);
+
+    while ( vrec[indx] ) {
+        STAT_ADD(var_probes, 1);
+        if (! strcmp(vrec[indx]->var, var) )
+            { *dup_at = indx; return -1; }
+        indx = (indx+1) & mask;
     }
 
-    if (indx == sz) return sz+1;
     return indx;
 }
 
-int make_entry (var_record **vrec, int *rec_sz, char *key, char *val)
+int make_entry (var_record ***vrec, int *rec_sz, int *nrec, char *key, char *val)
 {
-    int dup;
-    int indx = get_index(vrec, *rec_sz, key, &dup);
+    int dup, i;
+
+    if ((*nrec+1)*2 > *rec_sz) {
+        int sz = *rec_sz * 2;
+        var_record **grown = calloc(sz, sizeof(var_record *));
+        if (!grown) hndl_fatal_error("calloc");
+        for (i=0; i<*rec_sz; i++)
+            if ((*vrec)[i])
+                grown[get_index(grown, sz, (*vrec)[i]->var, &dup)] = (*vrec)[i];
+        free(*vrec);
+        *vrec = grown;
+        *rec_sz = sz;
+    }
+
+    int indx = get_index(*vrec, *rec_sz, key, &dup);
     
     /* duplicate */
     if (indx == -1) return -1;
 
-    if (indx > *rec_sz) {
-        fprintf(stderr, "Hash table full. Aborting..\n");
-        exit(1);
-        /*
-        vrec = realloc(vrec, (*rec_sz + MEM_CHUNK) * sizeof(var_record *));
-        if (! *vrec )
-            hndl_fatal_error("realloc");
-        *rec_sz += MEM_CHUNK;
-        */
+    (*vrec)[indx] = calloc(1, sizeof(var_record));
+    if (!(*vrec)[indx]) hndl_fatal_error("calloc");
+    (*vrec)[indx]->var = key;
+    (*vrec)[indx]->val = val;
+    (*nrec)++;
+    return indx;
+}
+
+/*
+ * node id that stays the same between versions of a description: the table
+ * name for a table and table/column for its columns. ids already handed out
+ * (duplicate tables or columns) get a #n suffix.
+ */
+char *make_uname(name_index *seen, char *tb_name, char *col, int col_indx)
+{
+    int len = strlen(tb_name) + strlen(col) + 2;
+    char *uname = calloc(len+12, sizeof(char));
+    if (!uname) hndl_fatal_error("calloc");
+
+    if (col_indx)
+        snprintf(uname, len, "%s/%s", tb_name, col);
+    else
+        strcpy(uname, tb_name);
+
+    if (nidx_insert(seen, uname, 0) < 0)
+        return uname;
+
+    /*
+     * the first free #n from the column index on. every #n handed out keeps
+     * the next n worth trying, and those are brought up to date on the way,
+     * so many repeats of one name don't try the same taken ids over and over
+     */
+    int n, next, found;
+    len = strlen(uname);
+    for (n = col_indx; ; n = next) {
+        snprintf(uname+len, 12, "#%d", n);
+        if ((next = nidx_lookup(seen, uname)) < 0)
+            break;
     }
-    
-    vrec[indx] = calloc(1, sizeof(var_record));
-    vrec[indx]->var = key;
-    vrec[indx]->val = val;
+    found = n;
+    for (n = col_indx; n != found; n = next) {
+        snprintf(uname+len, 12, "#%d", n);
+        next = nidx_lookup(seen, uname);
+        nidx_set(seen, uname, found+1);
+    }
+    snprintf(uname+len, 12, "#%d", found);
+    nidx_insert(seen, uname, found+1);
+
+    return uname;
 }
 
-node **parse_content(char *mem)
+void freemem(node **table);
+
+/* path as seen from the directory of the file that includes it */
+char *include_path(const char *from, const char *path)
+{
+    const char *slash = from ? strrchr(from, '/') : NULL;
+
+    if (*path == '/' || !slash) {
+        char *full = strdup(path);
+        if (!full) hndl_fatal_error("strdup");
+        return full;
+    }
+
+    int dir = slash - from + 1;
+    char *full = malloc(dir + strlen(path) + 1);
+    if (!full) hndl_fatal_error("malloc");
+    memcpy(full, from, dir);
+    strcpy(full+dir, path);
+    return full;
+}
+
+/* one name per file, so a file reached by two paths is still included once */
+char *canonical_path(char *path)
+{
+#ifdef __linux
+    char *real = realpath(path, NULL);
+    if (real) {
+        free(path);
+        return real;
+    }
+#endif
+    return path;
+}
+
+/* set by --serve, so a client can't have the daemon read its files */
+bool includes_off = false;
+
+/*
+ * first half of parsing: split a description into rows without resolving
+ * anything. variable declarations and includes become rows of their own,
+ * names stay as written. include paths are made relative to path, which
+ * also names the file in errors when nested.
+ */
+node **scan_content(char *mem, const char *path, bool nested)
 {
     node **table_arr = calloc(MEM_CHUNK, sizeof(node *));
     if (!table_arr)
         hndl_fatal_error("calloc");
-    var_record **vrec = calloc(HTAB_MAX, sizeof(var_record *));
-    if (!vrec)
-        hndl_fatal_error("calloc");
-    memset(vrec, 0, HTAB_MAX * sizeof(var_record *)); /* windows fix */
-    
+
     int tot_tb_alloc = MEM_CHUNK;
-    int tot_var_alloc = HTAB_MAX;
-    int tot_col_alloc = MEM_CHUNK;
     char *loop = mem;
-    const char *reg_var_decl = "^[a-zA-Z0-9 _.]+:[a-zA-Z0-9 _.]+$";
-    const char *reg_table_spec = "^[a-zA-Z0-9 _.^(]+\\([a-zA-Z0-9, _.]+\\)$";
-    const char *reg_rel_spec = "^[a-zA-Z0-9 ._]+>[a-zA-Z0-9 ._]+,[a-zA-Z0-9 ._()]+,[ ]*[1mnMN]{1}[ ]*:[ ]*[1mnMN]{1}[ ]*$";
     char *work_buff = NULL;
-    bool get_tbname;
-    int tb_indx = 0, col_indx = 0, hindx = 0;
+    int tb_indx = 0, col_indx = 0;
     int line_no=1;
 
     while ( (work_buff = getline_from_mem(&loop)) && *work_buff ) {
@@ -293,101 +710,93 @@ node **parse_content(char *mem)
         /* variable declaration */
         if ( handle_regex(work_buff, reg_var_decl, 0) ) {
             char *delim = ":";
-            char *key = NULL, *val = NULL;
 
-            key = split(work_buff, delim, false);
-            val = split(work_buff, delim, false);
+            table_arr[tb_indx] = calloc(3, sizeof(node));
+            if (!table_arr[tb_indx]) hndl_fatal_error("calloc");
+            table_arr[tb_indx][0].name = split(work_buff, delim, false);
+            table_arr[tb_indx][1].name = split(work_buff, delim, false);
+            table_arr[tb_indx][0].type = table_arr[tb_indx][1].type = VAR_SPEC;
             split(work_buff, delim, false);
-
-            if ( make_entry(vrec, &tot_var_alloc, key, val) == -1 ) {
-                fprintf(stderr, "Variable \"%s\" used for two different values. Ignoring..", key);
-                free(key);
-                free(val);
-            }
+            col_indx = 2;
         }
          /* parse table specs */
         else if ( handle_regex(work_buff, reg_table_spec, 0) ) {
 
-            get_tbname = true;
             table_arr[tb_indx] = calloc(MEM_CHUNK, sizeof(node));
-            int len;
-            char *tmp = NULL, *tb_name;
+            char *tmp = NULL;
             char *delim = "(,)";
 
             while ( (tmp = split(work_buff, delim, false)) ) {
-                /*
-                table_arr[tb_indx][col_indx] = calloc(strlen(tmp), sizeof(char));
-                strcpy(table_arr[tb_indx][col_indx], tmp);
-                */
-                /* variable substitution */
-                if ( get_index(vrec, tot_var_alloc, tmp, &hindx) == -1 ) {
-                    free(tmp);
-                    tmp = calloc(1, strlen(vrec[hindx]->val)+1);
-                    strcpy(tmp, vrec[hindx]->val);
-                }
-                if (get_tbname) { 
-                    tb_name = tmp;
-                    len = strlen(tb_name);
-                    get_tbname = false;
-                }
                 table_arr[tb_indx][col_indx].name = tmp;
-
-                int sz = len+strlen(tmp)+7;
-                table_arr[tb_indx][col_indx].uname = calloc(sz, sizeof(char));
-                snprintf(table_arr[tb_indx][col_indx].uname, sz-1, "%s_%s%.3d", tb_name, tmp, col_indx);
                 table_arr[tb_indx][col_indx].type = TB_SPEC;
                 col_indx++;
 
-                if (col_indx % MEM_CHUNK == 0) {
-                    table_arr[tb_indx] = realloc(table_arr[tb_indx], (tot_col_alloc+MEM_CHUNK)*sizeof(node *));
-                    tot_col_alloc += MEM_CHUNK;
+                /* doubles from MEM_CHUNK, so a wide table isn't copied over and over */
+                if (col_indx >= MEM_CHUNK && !(col_indx & (col_indx-1))) {
+                    table_arr[tb_indx] = realloc(table_arr[tb_indx], col_indx*2*sizeof(node));
+                    if (!table_arr[tb_indx])
+                        hndl_fatal_error("realloc");
                 }
             }
+            /* give back what the row didn't use, it's most of it for narrow tables */
+            table_arr[tb_indx] = realloc(table_arr[tb_indx], (col_indx+1)*sizeof(node));
+            if (!table_arr[tb_indx])
+                hndl_fatal_error("realloc");
         }
         /* parse relation specs */
         else if ( handle_regex(work_buff, reg_rel_spec, 0) ) {
 
-            table_arr[tb_indx] = calloc(MEM_CHUNK, sizeof(node));
+            table_arr[tb_indx] = calloc(5, sizeof(node));
+            if (!table_arr[tb_indx]) hndl_fatal_error("calloc");
             char *tmp = NULL;
             char *delim = ">,";
 
             while ( (tmp = split(work_buff, delim, false)) ) {
-                if ( /*!col_indx &&*/ (get_index(vrec, tot_var_alloc, tmp, &hindx) == -1) ) {
-                    /*
-                     * if value of a variable is stored at one place and
-                     * all ptrs ref to this block, free can be hazordous
-                     * hence, make copies
-                    */
-                    free(tmp);
-                    tmp = calloc(1, strlen(vrec[hindx]->val)+1);
-                    strcpy(tmp, vrec[hindx]->val);
-                }
                 table_arr[tb_indx][col_indx].name = tmp;
-                table_arr[tb_indx][col_indx].uname = NULL;
                 table_arr[tb_indx][col_indx].type = REL_SPEC;
-
-                if (col_indx == 3) {          /* cardinality */
-                    char *relc = NULL;
-
-                    relc = split(tmp, ":", true);
-                    table_arr[tb_indx][col_indx].from = relc[0];
-                    free(relc);
-
-                    relc = split(tmp, ":", false);
-                    table_arr[tb_indx][col_indx].to = relc[0];
-                    free(relc);
-
-                    split(tmp, ":", false);
-                    col_indx++;
-                    break;      /* this is the last element. */
-                }
                 col_indx++;
+                if (col_indx == 4) {
+                    split(work_buff, delim, false);
+                    break;      /* cardinality is the last element. */
+                }
             }
             /* no reallocation needed since regex already verifies max no of cols */
         }
+        /* include another description; last, so a table named include is still one */
+        else if ( handle_regex(work_buff, reg_include, 0) ) {
+            char *inc = work_buff + strlen("include");
+
+            if (includes_off) {
+                qerr("include is not allowed with --serve, on line: %d\n", line_no);
+                free(work_buff);
+                table_arr[tb_indx] = NULL;
+                freemem(table_arr);
+                return NULL;
+            }
+
+            while (*inc == ' ')
+                inc++;
+            chop_leadntrail(inc, strlen(inc));
+
+            table_arr[tb_indx] = calloc(2, sizeof(node));
+            if (!table_arr[tb_indx]) hndl_fatal_error("calloc");
+            table_arr[tb_indx][0].name = canonical_path(include_path(path, inc));
+            table_arr[tb_indx][0].type = INC_SPEC;
+            /* where it was included, for errors about the file */
+            const char *in = path ? path : "file";
+            table_arr[tb_indx][0].uname = malloc(strlen(in) + 32);
+            if (!table_arr[tb_indx][0].uname) hndl_fatal_error("malloc");
+            sprintf(table_arr[tb_indx][0].uname, "%s on line: %d", in, line_no);
+            col_indx++;
+        }
         else {
-            fprintf(stderr, "Wrong syntax in file on line: %d\n", line_no);
+            if (nested)
+                qerr("Wrong syntax in %s on line: %d\n", path, line_no);
+            else
+                qerr("Wrong syntax in file on line: %d\n", line_no);
             free(work_buff);
+            table_arr[tb_indx] = NULL;
+            freemem(table_arr);
             return NULL;
         }
 
@@ -401,200 +810,3823 @@ node **parse_content(char *mem)
         work_buff = NULL;
         line_no++;
 
-        if (tb_indx && (tb_indx % MEM_CHUNK == 0)) {
-            table_arr = realloc(table_arr, (tot_tb_alloc+MEM_CHUNK)*sizeof(node *));
-            tot_tb_alloc += MEM_CHUNK;
+        if (tb_indx == tot_tb_alloc) {
+            tot_tb_alloc *= 2;
+            table_arr = realloc(table_arr, tot_tb_alloc*sizeof(node *));
+            if (!table_arr) hndl_fatal_error("realloc");
         }
     }
     table_arr[tb_indx] = NULL;
     if (work_buff) free(work_buff);
 
-    if (!tb_indx) {
-        free(table_arr);
-        table_arr = NULL;
-    }
+    return table_arr;
+}
 
-    int x;
-    for (x = 0; x<tot_var_alloc; x++)
-        if (vrec[x]) {
-            free(vrec[x]->var);
-            free(vrec[x]->val);
-            free(vrec[x]);
-        }
-    free(vrec);
+/*
+ * include: every file a description includes is scanned once, those
+ * found in the same round in parallel (see load_includes). linking
+ * splices the rows in where the include line was, as if the files had
+ * been pasted together, and resolves every variable through one table.
+ * a file included more than once is spliced in the first time only.
+ */
+struct module_t {
+    char *path;
+    node **rows;
+};
 
-    return table_arr;
+#ifdef __linux
+pthread_mutex_t mod_lock = PTHREAD_MUTEX_INITIALIZER;
+#define MOD_LOCK() pthread_mutex_lock(&mod_lock)
+#define MOD_UNLOCK() pthread_mutex_unlock(&mod_lock)
+#else
+#define MOD_LOCK()
+#define MOD_UNLOCK()
+#endif
+
+/* 0 if path is a file that can be read, -1 otherwise */
+int file_usable(const char *path)
+{
+#ifdef __linux
+    struct stat sb;
+
+    if (stat(path, &sb) < 0 || !S_ISREG(sb.st_mode))
+        return -1;
+#else
+    FILE *fp = fopen(path, "r");
+
+    if (!fp)
+        return -1;
+    fclose(fp);
+#endif
+    return 0;
 }
 
-char *get_uname(node **table, char *key)
+void module_free(struct module_t *m)
 {
-    int i, j;
-    for (i=0; table[i]; i++) {
-        /*
-        for (j=0; table[i][j].name; j++) {
-            if (table[i][j].type == REL_SPEC) continue;
-            if (! strcmp(table[i][j].name, key) )
-                return table[i][j].uname;
-        }
-        */
-        if (table[i][0].type == REL_SPEC) continue;
-        if (! strcmp(table[i][0].name, key) )
-            return table[i][0].uname;
+    freemem(m->rows);
+    free(m->path);
+    free(m);
+}
+
+/* the scanned rows of path, included where from says */
+struct module_t *module_get(char *path, const char *from)
+{
+    struct module_t *m;
+    char *mem = NULL;
+
+    if (file_usable(path) < 0 || !(mem = read_file_into_mem(path))) {
+        qerr("Can't read included file %s, in %s\n", path, from);
+        return NULL;
     }
+    node **rows = scan_content(mem, path, true);
+    free(mem);
+    if (!rows) return NULL;
 
-    return NULL;
+    m = malloc(sizeof(struct module_t));
+    if (!m) hndl_fatal_error("malloc");
+    m->path = strdup(path);
+    if (!m->path) hndl_fatal_error("strdup");
+    m->rows = rows;
+
+    return m;
 }
 
-int sane_snprintf(char **buff, int *total, int count, char *fmt, ...)
+/* every file a description includes, directly or not */
+struct mod_set_t {
+    char **paths;
+    const char **from;      /* where each was first included, borrowed from its row */
+    struct module_t **mods;
+    int n, alloc;
+    name_index by_path;
+};
+
+void mod_set_add(struct mod_set_t *set, node **rows)
 {
-    int s, r;
-    va_list ap;
-    va_start(ap, fmt);
-    r = vsnprintf(NULL, 0, fmt, ap);
-    va_end(ap);
+    int i;
 
-    s = r;
-    if (s+1 > (*total-count)) {
-        s = (s+1 < OUTBUFF_CHUNK) ? OUTBUFF_CHUNK : s+1;
-        *buff = realloc(*buff, *total+s);
-        if (! *buff ) hndl_fatal_error("realloc");
-        *total += s;
+    for (i=0; rows[i]; i++) {
+        if (rows[i][0].type != INC_SPEC) continue;
+        if (nidx_lookup(&set->by_path, rows[i][0].name) >= 0) continue;
+
+        if (set->n == set->alloc) {
+            set->alloc = set->alloc ? set->alloc*2 : MEM_CHUNK;
+            set->paths = realloc(set->paths, set->alloc * sizeof(char *));
+            set->from = realloc(set->from, set->alloc * sizeof(char *));
+            set->mods = realloc(set->mods, set->alloc * sizeof(struct module_t *));
+            if (!set->paths || !set->from || !set->mods) hndl_fatal_error("realloc");
+        }
+        set->paths[set->n] = strdup(rows[i][0].name);
+        if (!set->paths[set->n]) hndl_fatal_error("strdup");
+        nidx_insert(&set->by_path, set->paths[set->n], set->n);
+        set->from[set->n] = rows[i][0].uname;
+        set->mods[set->n++] = NULL;
     }
+}
 
-    va_start(ap, fmt);
-    vsnprintf((*buff)+count, s+1, fmt, ap);
-    va_end(ap);
+/* files of one round of loading, handed out to whoever is free */
+struct load_round_t {
+    struct mod_set_t *set;
+    int start, next, end;
+    out_buf *err;       /* per file, shown in order once all are done */
+};
 
-    return r;
+void *load_worker(void *arg)
+{
+    struct load_round_t *lr = arg;
+    out_buf *sink = err_sink;
+
+    for (;;) {
+        MOD_LOCK();
+        int k = lr->next++;
+        MOD_UNLOCK();
+        if (k >= lr->end) break;
+
+        err_sink = &lr->err[k - lr->start];
+        lr->set->mods[k] = module_get(lr->set->paths[k], lr->set->from[k]);
+    }
+
+    err_sink = sink;
+    return NULL;
 }
 
-void write_gv_output(node **table, char *outfile)
+/*
+ * load the includes of rows and theirs in turn. files found in the same
+ * round don't depend on each other and are scanned in parallel.
+ */
+int load_includes(struct mod_set_t *set, node **rows)
 {
-#ifndef __gui
+    int start = set->n, i;
+    bool failed = false;
+
+    mod_set_add(set, rows);
+    while (start < set->n) {
+        struct load_round_t lr;
+        int nthreads = set->n - start;
+
+        lr.set = set;
+        lr.start = lr.next = start;
+        lr.end = set->n;
+        lr.err = calloc(lr.end - start, sizeof(out_buf));
+        if (!lr.err) hndl_fatal_error("calloc");
+        if (nthreads > LOAD_THREADS) nthreads = LOAD_THREADS;
 
 #ifdef __linux
-    if ( !access(outfile, F_OK) ) {
-        char r;
-        printf("File: %s exists. Overwrite? (y/n): ", outfile);
-        scanf("%c", &r);
-        if (r != 'y')
-            return;
-    }
-#elif _WIN32
-    DWORD dwAttrib = GetFileAttributes(szPath);
-    if (dwAttrib != INVALID_FILE_ATTRIBUTES && 
-        !(dwAttrib & FILE_ATTRIBUTE_DIRECTORY)) {
-        char r;
-        printf("File: %s exists. Overwrite? (y/n): ", outfile);
-        scanf("%c", &r);
-        if (r != 'y')
-            return;
-    }
-#endif
+        /* the --stats counters are not shared between threads */
+        if (nthreads > 1 && !qstats) {
+            pthread_t tid[LOAD_THREADS];
+            int started = 0;
 
+            warm_regex();
+            for (i=1; i<nthreads; i++)
+                if (!pthread_create(&tid[started], NULL, load_worker, &lr))
+                    started++;
+            load_worker(&lr);
+            for (i=0; i<started; i++)
+                pthread_join(tid[i], NULL);
+        }
+        else
 #endif
-    FILE *fp = fopen(outfile, "w");
-    if (!fp) {
-        hndl_fatal_error("fopen");
+            load_worker(&lr);
+
+        for (i=start; i<lr.end; i++) {
+            out_buf *eb = &lr.err[i - start];
+            if (eb->len) qerr("%.*s", (int)eb->len, eb->data);
+            free(eb->data);
+            if (set->mods[i])
+                mod_set_add(set, set->mods[i]->rows);
+            else
+                failed = true;
+        }
+        free(lr.err);
+        start = lr.end;
     }
-    
-    const char *initial = "graph main {\n\
-    ranksep=0.75;\n\
-    rankdir=TB;\n\
-    layout=dot;\n\
-    constraint=true;\n\
-    ";
 
-    fwrite(initial, 1, strlen(initial), fp);
+    return failed ? -1 : 0;
+}
 
-    char *outbuff = calloc(OUTBUFF_CHUNK, sizeof(char));
+/* state of the second half of parsing */
+struct link_ctx_t {
+    node **out;
+    int nout, aout;
+    var_record **vrec;
+    int tot_var_alloc, nvar;
+    name_index seen;            /* unames handed out */
+    name_index linked;          /* includes already spliced in */
+    struct mod_set_t *set;
+};
+
+/*
+ * second half: substitute variables, hand out unames and read the
+ * cardinality, appending the rows to lc->out. rows owned by the caller
+ * are reused and freed, rows of an included file are copied.
+ */
+void link_rows(struct link_ctx_t *lc, node **rows, bool owned)
+{
+    int i, j, hindx = 0;
+
+    for (i=0; rows[i]; i++) {
+        node *row = rows[i];
+
+        if (row[0].type == VAR_SPEC) {
+            char *key = row[0].name, *val = row[1].name;
+            if (!owned) {
+                key = strdup(key);
+                val = strdup(val);
+                if (!key || !val) hndl_fatal_error("strdup");
+            }
+            if ( make_entry(&lc->vrec, &lc->tot_var_alloc, &lc->nvar, key, val) == -1 ) {
+                qerr("Variable \"%s\" used for two different values. Ignoring..", key);
+                free(key);
+                free(val);
+            }
+            if (owned) free(row);
+            continue;
+        }
+
+        if (row[0].type == INC_SPEC) {
+            int m = nidx_lookup(&lc->set->by_path, row[0].name);
+            struct module_t *mod = lc->set->mods[m];
+
+            if (nidx_insert(&lc->linked, mod->path, 0) < 0)
+                link_rows(lc, mod->rows, false);
+            if (owned) {
+                free(row[0].name);
+                free(row[0].uname);
+                free(row);
+            }
+            continue;
+        }
+
+        if (!owned) {
+            for (j=0; row[j].name; j++)
+                ;
+            node *copy = calloc(j+1, sizeof(node));
+            if (!copy) hndl_fatal_error("calloc");
+            memcpy(copy, row, j * sizeof(node));
+            row = copy;
+        }
+
+        for (j=0; row[j].name; j++) {
+            char *tmp = row[j].name;
+
+            /* variable substitution */
+            if ( get_index(lc->vrec, lc->tot_var_alloc, tmp, &hindx) == -1 ) {
+                /*
+                 * if value of a variable is stored at one place and
+                 * all ptrs ref to this block, free can be hazordous
+                 * hence, make copies
+                */
+                if (owned) free(tmp);
+                tmp = calloc(1, strlen(lc->vrec[hindx]->val)+1);
+                strcpy(tmp, lc->vrec[hindx]->val);
+            }
+            else if (!owned) {
+                tmp = strdup(tmp);
+                if (!tmp) hndl_fatal_error("strdup");
+            }
+            row[j].name = tmp;
+            row[j].uname = NULL;
+
+            if (row[j].type == TB_SPEC)
+                row[j].uname = make_uname(&lc->seen, row[0].name, tmp, j);
+            else if (j == 3) {          /* cardinality */
+                char *relc = NULL;
+
+                relc = split(tmp, ":", true);
+                row[j].from = relc[0];
+                free(relc);
+
+                relc = split(tmp, ":", false);
+                row[j].to = relc[0];
+                free(relc);
+
+                split(tmp, ":", false);
+            }
+        }
+
+        if (lc->nout+1 >= lc->aout) {
+            lc->aout *= 2;
+            lc->out = realloc(lc->out, lc->aout * sizeof(node *));
+            if (!lc->out) hndl_fatal_error("realloc");
+        }
+        lc->out[lc->nout++] = row;
+    }
+
+    if (owned) free(rows);
+}
+
+/*
+ * parse_content for a description read from path (NULL when it wasn't
+ * read from a file), which the paths in its include lines are relative to
+ */
+node **parse_description(char *mem, const char *path)
+{
+    node **rows = scan_content(mem, path, false);
+    if (!rows)
+        return NULL;
+
+    struct mod_set_t set = { NULL, NULL, NULL, 0, 0 };
+    nidx_init(&set.by_path, MEM_CHUNK);
+
+    if (load_includes(&set, rows) < 0) {
+        freemem(rows);
+        rows = NULL;
+    }
+
+    struct link_ctx_t lc;
+    char *self = NULL;
+    int x;
+
+    memset(&lc, 0, sizeof(lc));
+    if (rows) {
+        lc.aout = MEM_CHUNK;
+        lc.out = malloc(lc.aout * sizeof(node *));
+        lc.vrec = calloc(HTAB_SIZE, sizeof(var_record *));
+        if (!lc.out || !lc.vrec)
+            hndl_fatal_error("calloc");
+        memset(lc.vrec, 0, HTAB_SIZE * sizeof(var_record *)); /* windows fix */
+        lc.tot_var_alloc = HTAB_SIZE;
+        lc.set = &set;
+        nidx_init(&lc.seen, MEM_CHUNK);
+        nidx_init(&lc.linked, MEM_CHUNK);
+        if (path) {     /* an include of the description itself adds nothing */
+            self = canonical_path(include_path(NULL, path));
+            nidx_insert(&lc.linked, self, 0);
+        }
+
+        link_rows(&lc, rows, true);
+        lc.out[lc.nout] = NULL;
+
+        if (!lc.nout) {
+            free(lc.out);
+            lc.out = NULL;
+        }
+
+        for (x = 0; x<lc.tot_var_alloc; x++)
+            if (lc.vrec[x]) {
+                free(lc.vrec[x]->var);
+                free(lc.vrec[x]->val);
+                free(lc.vrec[x]);
+            }
+        free(lc.vrec);
+        nidx_free(&lc.seen);
+        nidx_free(&lc.linked);
+        free(self);
+    }
+
+    for (x=0; x<set.n; x++) {
+        if (set.mods[x])
+            module_free(set.mods[x]);
+        free(set.paths[x]);
+    }
+    free(set.paths);
+    free(set.from);
+    free(set.mods);
+    nidx_free(&set.by_path);
+
+    return lc.out;
+}
+
+node **parse_content(char *mem)
+{
+    return parse_description(mem, NULL);
+}
+
+/*
+ * --sql: tables and foreign keys straight from the CREATE TABLE and
+ * ALTER TABLE statements of a dump (pg_dump --schema-only, mysqldump
+ * --no-data). the dump is read in chunks and only the statement at hand
+ * is kept, and only if it is one of those, so memory stays that of the
+ * largest table definition however big the dump is. a foreign key
+ * becomes a child > parent relationship named after its columns, m:1.
+ */
+enum sql_tok { SQL_WORD, SQL_QUOTED, SQL_PUNCT, SQL_OTHER };
+
+struct sql_reader_t {
+    FILE *fp;
+    char *buf;
+    size_t pos, len, counted;
+    long line;
+};
+
+struct sql_token_t {
+    char type;
+    size_t text;        /* offset in the statement's text */
+};
+
+struct sql_stmt_t {
+    struct sql_token_t *tok;
+    int ntok, atok;
+    out_buf text;
+    long line;          /* where the statement starts */
+    char kind;          /* 'c'reate table, 'a'lter table, c'o'py, 0 not known yet */
+    bool skip;          /* none of those, or too long */
+};
+
+struct sql_model_t {
+    node **rows;
+    int n, alloc;
+    name_index seen;
+};
+
+/* lines before the read position, counted as late as possible */
+long sql_line(struct sql_reader_t *r)
+{
+    char *p = r->buf + r->counted, *end = r->buf + r->pos;
+
+    while (p < end && (p = memchr(p, '\n', end - p))) {
+        r->line++;
+        p++;
+    }
+    if (r->pos > r->counted)
+        r->counted = r->pos;
+    return r->line;
+}
+
+int sql_fill(struct sql_reader_t *r)
+{
+    r->pos = r->len;
+    sql_line(r);
+    r->len = fread(r->buf, 1, SQL_CHUNK, r->fp);
+    r->pos = r->counted = 0;
+    STAT_ADD(read_bytes, r->len);
+    if (!r->len) return EOF;
+    return (unsigned char)r->buf[r->pos++];
+}
+
+#define SQL_GETC(r) ((r)->pos < (r)->len ? (unsigned char)(r)->buf[(r)->pos++] : sql_fill(r))
+#define SQL_UNGETC(r, c) do { if ((c) != EOF) (r)->pos--; } while (0)
+
+bool sql_word_char(int c)
+{
+    return isalnum(c) || c == '_' || c == '$' || c >= 0x80;
+}
+
+void sql_emit(struct sql_reader_t *r, struct sql_stmt_t *st, char type, const char *text, size_t len)
+{
+    if (st->skip)
+        return;
+    if (!st->ntok)
+        st->line = sql_line(r);
+
+    /* decide from the first few tokens whether the statement is kept */
+    if (!st->kind) {
+        bool word = (type == SQL_WORD);
+        if (st->ntok == 0 && !(word && (!strcmp(text, "create") || !strcmp(text, "alter") ||
+                                        !strcmp(text, "copy"))))
+            st->skip = true;
+        else if (st->ntok == 0 && !strcmp(text, "copy"))
+            st->kind = 'o';
+        else if (st->ntok > 0 && word && !strcmp(text, "table"))
+            st->kind = st->text.data[0] == 'c' ? 'c' : 'a';
+        else if (st->ntok > 0 && (st->ntok > 3 || st->text.data[0] == 'a'))
+            st->skip = true;   /* create index, alter sequence, ... */
+
+        if (st->skip) {
+            st->ntok = 0;
+            st->text.len = 0;
+            return;
+        }
+    }
+
+    if (st->text.len + len > SQL_MAX_STMT) {
+        qerr("Statement on line %ld too long, skipped\n", st->line);
+        st->skip = true;
+        st->kind = 0;
+        st->ntok = 0;
+        st->text.len = 0;
+        return;
+    }
+    if (st->ntok == st->atok) {
+        st->atok = st->atok ? st->atok*2 : OUTBUFF_CHUNK;
+        st->tok = realloc(st->tok, st->atok * sizeof(struct sql_token_t));
+        if (!st->tok) hndl_fatal_error("realloc");
+    }
+    st->tok[st->ntok].type = type;
+    st->tok[st->ntok++].text = st->text.len;
+    out_write(text, len, &st->text);
+    out_write("", 1, &st->text);
+}
+
+/* skip a string literal whose opening quote was just read */
+void sql_skip_string(struct sql_reader_t *r, bool backslash)
+{
+    int c;
+
+    while ( (c = SQL_GETC(r)) != EOF ) {
+        if (backslash && c == '\\')
+            SQL_GETC(r);
+        else if (c == '\'') {
+            c = SQL_GETC(r);
+            if (c != '\'') {    /* '' stands for a quote */
+                SQL_UNGETC(r, c);
+                return;
+            }
+        }
+    }
+}
+
+/* skip the body of a $tag$ quoted string, tag already read */
+void sql_skip_dollar(struct sql_reader_t *r, const char *tag, int tlen)
+{
+    int c, k;
+
+    while ( (c = SQL_GETC(r)) != EOF ) {
+        if (c != '$') continue;
+        for (k=0; k<tlen; k++) {
+            c = SQL_GETC(r);
+            if (c != tag[k]) break;
+        }
+        if (k < tlen) {
+            SQL_UNGETC(r, c);   /* may open the real end */
+            continue;
+        }
+        c = SQL_GETC(r);
+        if (c == '$')
+            return;
+        SQL_UNGETC(r, c);
+    }
+}
+
+/* token i of st, "" past the end */
+const char *sql_tok(struct sql_stmt_t *st, int i)
+{
+    return i < st->ntok ? st->text.data + st->tok[i].text : "";
+}
+
+bool sql_is(struct sql_stmt_t *st, int i, const char *word)
+{
+    return i < st->ntok && st->tok[i].type == SQL_WORD && !strcmp(sql_tok(st, i), word);
+}
+
+bool sql_punct(struct sql_stmt_t *st, int i, char c)
+{
+    return i < st->ntok && st->tok[i].type == SQL_PUNCT && *sql_tok(st, i) == c;
+}
+
+bool sql_ident(struct sql_stmt_t *st, int i)
+{
+    return i < st->ntok && (st->tok[i].type == SQL_WORD || st->tok[i].type == SQL_QUOTED);
+}
+
+/* a possibly schema qualified name at *i, without the schema */
+const char *sql_qname(struct sql_stmt_t *st, int *i)
+{
+    if (!sql_ident(st, *i))
+        return NULL;
+
+    const char *name = sql_tok(st, (*i)++);
+    while (sql_punct(st, *i, '.') && sql_ident(st, *i+1)) {
+        name = sql_tok(st, *i+1);
+        *i += 2;
+    }
+    return name;
+}
+
+/* a copy of name holding only what the description syntax allows */
+char *sql_name(const char *name, size_t len)
+{
+    char *s = malloc(len+1);
+    size_t k;
+    int n;
+
+    if (!s) hndl_fatal_error("malloc");
+    for (k=0; k<len; k++)
+        if (isalnum((unsigned char)name[k]) || strchr(" _.", name[k]))
+            s[k] = name[k];
+        else if ((n = utf8_seq((const unsigned char *)name+k, (const unsigned char *)name+len))) {
+            memcpy(s+k, name+k, n);
+            k += n-1;
+        }
+        else
+            s[k] = '_';
+    s[len] = 0;
+    return s;
+}
+
+/* the names in (a, b, ...) at *i, space separated; *i moves past it */
+char *sql_name_list(struct sql_stmt_t *st, int *i)
+{
+    out_buf ob = { NULL, 0, 0 };
+
+    if (!sql_punct(st, *i, '('))
+        return NULL;
+    for ((*i)++; *i < st->ntok && !sql_punct(st, *i, ')'); (*i)++) {
+        if (!sql_ident(st, *i)) continue;
+        if (ob.len) out_write(" ", 1, &ob);
+        out_write(sql_tok(st, *i), strlen(sql_tok(st, *i)), &ob);
+    }
+    (*i)++;
+
+    char *s = sql_name(ob.data ? ob.data : "", ob.len);
+    free(ob.data);
+    return s;
+}
+
+void sql_add_row(struct sql_model_t *m, node *row)
+{
+    if (m->n+1 >= m->alloc) {
+        m->alloc *= 2;
+        m->rows = realloc(m->rows, m->alloc * sizeof(node *));
+        if (!m->rows) hndl_fatal_error("realloc");
+    }
+    m->rows[m->n++] = row;
+}
+
+/* child > parent, named after the referencing columns */
+void sql_add_rel(struct sql_model_t *m, const char *child, const char *parent, char *cols)
+{
+    node *row = calloc(5, sizeof(node));
+    if (!row) hndl_fatal_error("calloc");
+
+    row[0].name = sql_name(child, strlen(child));
+    row[1].name = sql_name(parent, strlen(parent));
+    row[2].name = cols;
+    row[3].name = sql_name("m:1", 3);
+    row[3].from = 'm';
+    row[3].to = '1';
+    row[0].type = row[1].type = row[2].type = row[3].type = REL_SPEC;
+    sql_add_row(m, row);
+}
+
+/* FOREIGN KEY [name] (cols) REFERENCES parent [(cols)] at *i */
+void sql_foreign_key(struct sql_model_t *m, struct sql_stmt_t *st, int *i, const char *child)
+{
+    int k = *i + 1;
+
+    if (!sql_is(st, k++, "key"))
+        return;
+    if (sql_ident(st, k))   /* mysql's index name */
+        k++;
+
+    char *cols = sql_name_list(st, &k);
+    const char *parent = NULL;
+    if (cols && sql_is(st, k, "references")) {
+        k++;
+        parent = sql_qname(st, &k);
+    }
+    if (parent)
+        sql_add_rel(m, child, parent, cols);
+    else
+        free(cols);
+    *i = k;
+}
+
+bool sql_table_constraint(struct sql_stmt_t *st, int k)
+{
+    static const char *word[] = { "primary", "unique", "check", "exclude", "like", "period", NULL };
+    int w;
+
+    for (w=0; word[w]; w++)
+        if (sql_is(st, k, word[w]))
+            return true;
+
+    /* mysql's KEY name (cols), INDEX (cols), FULLTEXT KEY ... */
+    if (sql_is(st, k, "key") || sql_is(st, k, "index") || sql_is(st, k, "fulltext") || sql_is(st, k, "spatial"))
+        return sql_punct(st, k+1, '(') || (k+1 < st->ntok && st->tok[k+1].type == SQL_QUOTED) ||
+               sql_is(st, k+1, "key") || sql_is(st, k+1, "index");
+    return false;
+}
+
+void sql_create_table(struct sql_model_t *m, struct sql_stmt_t *st)
+{
+    int i = 1, ncol = 0, acol = MEM_CHUNK, j;
+
+    while (!sql_is(st, i, "table"))
+        i++;
+    i++;
+    if (sql_is(st, i, "if"))
+        i += 3;     /* if not exists */
+
+    const char *tb = sql_qname(st, &i);
+    if (!tb || !sql_punct(st, i, '('))
+        return;     /* AS SELECT, PARTITION OF ... have no columns of their own */
+
+    node *row = calloc(acol, sizeof(node));
+    if (!row) hndl_fatal_error("calloc");
+    row[ncol++].name = sql_name(tb, strlen(tb));
+
+    /* the table goes before the relationships of its columns */
+    int at = m->n;
+    sql_add_row(m, NULL);
+
+    int s = i+1;
+    while (s < st->ntok) {
+        int e = s, depth = 0;
+
+        /* one column or constraint, up to a ',' or ')' of this level */
+        for (; e < st->ntok; e++) {
+            if (sql_punct(st, e, '(')) depth++;
+            else if (sql_punct(st, e, ')') && !depth--) break;
+            else if (sql_punct(st, e, ',') && !depth) break;
+        }
+
+        int k = s;
+        if (sql_is(st, k, "constraint"))
+            k += 2;
+        if (sql_is(st, k, "foreign"))
+            sql_foreign_key(m, st, &k, tb);
+        else if (k == s && sql_ident(st, s) && !sql_table_constraint(st, s)) {
+            const char *col = sql_tok(st, s);
+
+            if (ncol+1 == acol) {
+                acol *= 2;
+                row = realloc(row, acol * sizeof(node));
+                if (!row) hndl_fatal_error("realloc");
+            }
+            row[ncol++].name = sql_name(col, strlen(col));
+
+            /* col type REFERENCES parent (col) */
+            for (k=s+1; k<e; k++) {
+                if (!sql_is(st, k, "references")) continue;
+                k++;
+                const char *parent = sql_qname(st, &k);
+                if (parent)
+                    sql_add_rel(m, tb, parent, sql_name(col, strlen(col)));
+                break;
+            }
+        }
+
+        if (e >= st->ntok || sql_punct(st, e, ')'))
+            break;
+        s = e+1;
+    }
+
+    row[ncol].name = NULL;
+    for (j=0; j<ncol; j++) {
+        row[j].type = TB_SPEC;
+        row[j].uname = make_uname(&m->seen, row[0].name, row[j].name, j);
+    }
+    m->rows[at] = row;
+}
+
+void sql_alter_table(struct sql_model_t *m, struct sql_stmt_t *st)
+{
+    int i = 2;
+
+    while (sql_is(st, i, "only") || sql_is(st, i, "if") || sql_is(st, i, "exists"))
+        i++;
+
+    const char *tb = sql_qname(st, &i);
+    if (!tb)
+        return;
+
+    while (i < st->ntok) {
+        if (sql_is(st, i, "foreign"))
+            sql_foreign_key(m, st, &i, tb);
+        else
+            i++;
+    }
+}
+
+void sql_statement(struct sql_model_t *m, struct sql_stmt_t *st)
+{
+    if (st->kind == 'c')
+        sql_create_table(m, st);
+    else if (st->kind == 'a')
+        sql_alter_table(m, st);
+
+    st->ntok = 0;
+    st->text.len = 0;
+    st->kind = 0;
+    st->skip = false;
+}
+
+/* the rows of COPY ... FROM stdin, up to the \. line */
+void sql_skip_copy(struct sql_reader_t *r)
+{
+    int c, col = 0;
+    bool dot = false;
+
+    while ( (c = SQL_GETC(r)) != EOF ) {
+        if (c == '\r')
+            continue;
+        if (c == '\n') {
+            if (dot && col == 2)
+                return;
+            col = 0;
+            dot = false;
+            continue;
+        }
+        if ((col == 0 && c == '\\') || (col == 1 && dot && c == '.'))
+            dot = true;
+        else
+            dot = false;
+        col++;
+    }
+}
+
+node **import_sql(const char *infile)
+{
+    struct sql_reader_t r = { NULL, NULL, 0, 0, 0, 1 };
+    struct sql_stmt_t st;
+    struct sql_model_t m;
+    char word[SQL_WORD_MAX+1];
+    int c, n;
+
+    if (!strcmp(infile, "-"))
+        r.fp = stdin;
+    else if ( !(r.fp = fopen(infile, "r")) )
+        hndl_fatal_error("fopen");
+    r.buf = malloc(SQL_CHUNK);
+    if (!r.buf) hndl_fatal_error("malloc");
+
+    memset(&st, 0, sizeof(st));
+    m.n = 0;
+    m.alloc = MEM_CHUNK;
+    m.rows = malloc(m.alloc * sizeof(node *));
+    if (!m.rows) hndl_fatal_error("malloc");
+    nidx_init(&m.seen, OUTBUFF_CHUNK);
+
+    while ( (c = SQL_GETC(&r)) != EOF ) {
+        if (isspace(c))
+            continue;
+
+        if (c == '-' || c == '/') {
+            int d = SQL_GETC(&r);
+            if (c == '-' && d == '-') {             /* -- comment */
+                while ( (c = SQL_GETC(&r)) != EOF && c != '\n' )
+                    ;
+                continue;
+            }
+            if (c == '/' && d == '*') {             /* block comments nest in postgres */
+                int depth = 1, prev = 0;
+                while (depth && (c = SQL_GETC(&r)) != EOF) {
+                    if (prev == '/' && c == '*') depth++, c = 0;
+                    else if (prev == '*' && c == '/') depth--, c = 0;
+                    prev = c;
+                }
+                continue;
+            }
+            SQL_UNGETC(&r, d);
+            sql_emit(&r, &st, SQL_OTHER, "", 0);
+            continue;
+        }
+
+        if (c == '\'') {
+            sql_skip_string(&r, false);
+            sql_emit(&r, &st, SQL_OTHER, "", 0);
+            continue;
+        }
+
+        if (c == '"' || c == '`') {                 /* quoted identifier, kept as is */
+            int q = c;
+            n = 0;
+            while ( (c = SQL_GETC(&r)) != EOF ) {
+                if (c == q) {
+                    c = SQL_GETC(&r);
+                    if (c != q) {
+                        SQL_UNGETC(&r, c);
+                        break;
+                    }
+                }
+                if (n < SQL_WORD_MAX) word[n++] = c;
+            }
+            word[n] = 0;
+            sql_emit(&r, &st, SQL_QUOTED, word, n);
+            continue;
+        }
+
+        if (c == '$') {                             /* $tag$ ... $tag$ */
+            n = 0;
+            while ( (c = SQL_GETC(&r)) != EOF && (isalnum(c) || c == '_') )
+                if (n < SQL_WORD_MAX) word[n++] = c;
+            if (c == '$' && !(n && isdigit((unsigned char)word[0])))
+                sql_skip_dollar(&r, word, n);
+            else
+                SQL_UNGETC(&r, c);
+            sql_emit(&r, &st, SQL_OTHER, "", 0);
+            continue;
+        }
+
+        if (sql_word_char(c)) {
+            n = 0;
+            do {
+                if (n < SQL_WORD_MAX) word[n++] = tolower(c);
+            } while ( (c = SQL_GETC(&r)) != EOF && sql_word_char(c) );
+
+            if (n == 1 && word[0] == 'e' && c == '\'') {    /* E'...' takes backslash escapes */
+                sql_skip_string(&r, true);
+                sql_emit(&r, &st, SQL_OTHER, "", 0);
+                continue;
+            }
+            SQL_UNGETC(&r, c);
+            word[n] = 0;
+            sql_emit(&r, &st, SQL_WORD, word, n);
+            continue;
+        }
+
+        word[0] = c;
+        word[1] = 0;
+        if (c == ';') {
+            bool copy = false;
+            for (n=0; st.kind == 'o' && n<st.ntok; n++)
+                if (sql_is(&st, n, "stdin")) copy = true;
+            sql_statement(&m, &st);
+            if (copy)
+                sql_skip_copy(&r);
+        }
+        else
+            sql_emit(&r, &st, strchr("(),.", c) ? SQL_PUNCT : SQL_OTHER, word, 1);
+    }
+    if (st.kind)    /* no ; after the last one */
+        sql_statement(&m, &st);
+
+    if (r.fp != stdin)
+        fclose(r.fp);
+    free(r.buf);
+    free(st.tok);
+    free(st.text.data);
+    nidx_free(&m.seen);
+
+    /* keys that point outside the dump can't be drawn */
+    name_index tables;
+    int i, j, kept = 0;
+
+    nidx_init(&tables, m.n);
+    for (i=0; i<m.n; i++)
+        if (m.rows[i][0].type == TB_SPEC)
+            nidx_insert(&tables, m.rows[i][0].name, i);
+    for (i=0; i<m.n; i++) {
+        node *row = m.rows[i];
+        if (row[0].type == REL_SPEC &&
+            (nidx_lookup(&tables, row[0].name) < 0 || nidx_lookup(&tables, row[1].name) < 0)) {
+            qerr("Foreign key %s -> %s (%s) skipped: table \"%s\" not in the dump\n",
+                 row[0].name, row[1].name, row[2].name,
+                 nidx_lookup(&tables, row[0].name) < 0 ? row[0].name : row[1].name);
+            for (j=0; row[j].name; j++)
+                free(row[j].name);
+            free(row);
+            continue;
+        }
+        m.rows[kept++] = row;
+    }
+    nidx_free(&tables);
+    m.rows[kept] = NULL;
+
+    if (!kept) {
+        qerr("No CREATE TABLE statements in %s\n", infile);
+        free(m.rows);
+        return NULL;
+    }
+    return m.rows;
+}
+
+/* node id of the first table named key, through an index of the table rows by name */
+char *get_uname(node **table, name_index *by_name, char *key)
+{
+    STAT_START(t0);
+    STAT_ADD(uname_lookups, 1);
+    int i = nidx_lookup(by_name, key);
+
+    STAT_STOP(uname_ns, t0);
+    return i >= 0 ? table[i][0].uname : NULL;
+}
+
+struct rel_edge_t {
+    int row;        /* relationship row in the table array */
+    int src, dst;   /* table ids */
+};
+
+/* tables and the relationships between them, indexed for traversal */
+struct schema_graph_t {
+    int ntb, nrel;
+    int *tb_row;            /* table id -> row in the table array */
+    int *row_tb;            /* row -> table id, -1 for relationship rows */
+    struct rel_edge_t *rel;
+    int *adj_off, *adj;     /* undirected adjacency, adj holds rel ids */
+    name_index by_name;
+};
+
+typedef struct schema_graph_t schema_graph;
+
+int build_graph(node **table, schema_graph *g)
+{
+    int nrows, i;
+
+    for (nrows=0; table[nrows]; nrows++)
+        ;
+
+    memset(g, 0, sizeof(schema_graph));
+    g->tb_row = malloc((nrows+1) * sizeof(int));
+    g->row_tb = malloc((nrows+1) * sizeof(int));
+    g->rel = malloc((nrows+1) * sizeof(struct rel_edge_t));
+    if (!g->tb_row || !g->row_tb || !g->rel)
+        hndl_fatal_error("malloc");
+    nidx_init(&g->by_name, nrows);
+
+    /* duplicate table names resolve to the first definition, as in get_uname */
+    for (i=0; i<nrows; i++) {
+        g->row_tb[i] = -1;
+        if (table[i][0].type != TB_SPEC) continue;
+        g->row_tb[i] = g->ntb;
+        g->tb_row[g->ntb] = i;
+        nidx_insert(&g->by_name, table[i][0].name, g->ntb);
+        g->ntb++;
+    }
+
+    for (i=0; i<nrows; i++) {
+        if (table[i][0].type != REL_SPEC) continue;
+        int src = nidx_lookup(&g->by_name, table[i][0].name);
+        int dst = nidx_lookup(&g->by_name, table[i][1].name);
+
+        if (src < 0 || dst < 0) {
+            qerr("Unknown table in relationship %d : \"%s\" -> \"%s\"\nTable \"%s\" not defined\n",
+                    g->nrel+1, table[i][0].name, table[i][1].name,
+                    (src >= 0 ? table[i][1].name : table[i][0].name));
+            return -1;
+        }
+        g->rel[g->nrel].row = i;
+        g->rel[g->nrel].src = src;
+        g->rel[g->nrel].dst = dst;
+        g->nrel++;
+    }
+
+    /* counting pass, then fill */
+    g->adj_off = calloc(g->ntb+1, sizeof(int));
+    g->adj = malloc((2*g->nrel+1) * sizeof(int));
+    if (!g->adj_off || !g->adj)
+        hndl_fatal_error("calloc");
+
+    for (i=0; i<g->nrel; i++) {
+        g->adj_off[g->rel[i].src+1]++;
+        g->adj_off[g->rel[i].dst+1]++;
+    }
+    for (i=0; i<g->ntb; i++)
+        g->adj_off[i+1] += g->adj_off[i];
+
+    int *fill = malloc((g->ntb+1) * sizeof(int));
+    if (!fill) hndl_fatal_error("malloc");
+    memcpy(fill, g->adj_off, g->ntb * sizeof(int));
+    for (i=0; i<g->nrel; i++) {
+        g->adj[fill[g->rel[i].src]++] = i;
+        g->adj[fill[g->rel[i].dst]++] = i;
+    }
+    free(fill);
+
+    return 0;
+}
+
+void free_graph(schema_graph *g)
+{
+    free(g->tb_row);
+    free(g->row_tb);
+    free(g->rel);
+    free(g->adj_off);
+    free(g->adj);
+    nidx_free(&g->by_name);
+}
+
+/*
+ * restrict the table array to everything within depth relationships of the
+ * comma separated focus tables. the returned array shares rows with table,
+ * so only the array itself is to be freed. *elided receives, per row of the
+ * view, how many relationships of that table were left out.
+ */
+node **focus_view(node **table, schema_graph *g, char *focus, int depth, int **elided)
+{
+    int *dist = malloc((g->ntb+1) * sizeof(int));
+    int *queue = malloc((g->ntb+1) * sizeof(int));
+    if (!dist || !queue)
+        hndl_fatal_error("malloc");
+
+    int i, head = 0, tail = 0;
+    for (i=0; i<g->ntb; i++)
+        dist[i] = -1;
+
+    char *tmp = split(focus, ",", true);
+    for (; tmp; tmp = split(focus, ",", false)) {
+        int t = nidx_lookup(&g->by_name, tmp);
+        if (t < 0) {
+            qerr("Focus table \"%s\" not defined\n", tmp);
+            free(tmp);
+            while ( (tmp = split(focus, ",", false)) )  /* rewind split */
+                free(tmp);
+            free(dist);
+            free(queue);
+            return NULL;
+        }
+        if (dist[t] < 0) {
+            dist[t] = 0;
+            queue[tail++] = t;
+        }
+        free(tmp);
+    }
+
+    /* breadth first, so each table is reached at its shortest distance */
+    while (head < tail) {
+        int t = queue[head++];
+        if (dist[t] >= depth) continue;
+
+        int k;
+        for (k = g->adj_off[t]; k < g->adj_off[t+1]; k++) {
+            struct rel_edge_t *e = &g->rel[g->adj[k]];
+            int other = (e->src == t) ? e->dst : e->src;
+            if (dist[other] < 0) {
+                dist[other] = dist[t]+1;
+                queue[tail++] = other;
+            }
+        }
+    }
+
+    int nrows;
+    for (nrows=0; table[nrows]; nrows++)
+        ;
+    int *rel_of_row = malloc((nrows+1) * sizeof(int));
+    node **view = calloc(nrows+1, sizeof(node *));
+    *elided = calloc(nrows+1, sizeof(int));
+    if (!rel_of_row || !view || !*elided)
+        hndl_fatal_error("calloc");
+
+    for (i=0; i<nrows; i++)
+        rel_of_row[i] = -1;
+    for (i=0; i<g->nrel; i++)
+        rel_of_row[g->rel[i].row] = i;
+
+    int v = 0;
+    for (i=0; i<nrows; i++) {
+        int t = g->row_tb[i];
+        if (t >= 0) {
+            if (dist[t] < 0) continue;
+
+            int k, cut = 0;
+            for (k = g->adj_off[t]; k < g->adj_off[t+1]; k++) {
+                struct rel_edge_t *e = &g->rel[g->adj[k]];
+                if (dist[e->src] < 0 || dist[e->dst] < 0)
+                    cut++;
+            }
+            (*elided)[v] = cut;
+            view[v++] = table[i];
+        }
+        else if (rel_of_row[i] >= 0) {
+            struct rel_edge_t *e = &g->rel[rel_of_row[i]];
+            if (dist[e->src] >= 0 && dist[e->dst] >= 0)
+                view[v++] = table[i];
+        }
+    }
+    view[v] = NULL;
+
+    free(rel_of_row);
+    free(dist);
+    free(queue);
+    return view;
+}
+
+void out_write(const void *buff, size_t count, out_buf *ob)
+{
+    if (ob->len + count > ob->size) {
+        size_t sz = ob->size ? ob->size : OUTBUFF_CHUNK*8;
+        while (ob->len + count > sz)
+            sz *= 2;
+        ob->data = realloc(ob->data, sz);
+        if (!ob->data) hndl_fatal_error("realloc");
+        ob->size = sz;
+    }
+    memcpy(ob->data + ob->len, buff, count);
+    ob->len += count;
+}
+
+/*
+ * put data at outfile ("-" is stdout) with a single write. the bytes go to
+ * a temporary file next to outfile, sized up front, which is then renamed
+ * over it, so nobody ever sees a partly written file.
+ */
+int commit_output(const char *outfile, const char *data, size_t len)
+{
+    STAT_START(t0);
+    STAT_ADD(write_calls, 1);
+    STAT_ADD(write_bytes, len);
+
+    if (!strcmp(outfile, "-")) {
+        if ((len && fwrite(data, 1, len, stdout) != len) || fflush(stdout)) {
+            perror("write");
+            return -1;
+        }
+        STAT_STOP(write_ns, t0);
+        return 0;
+    }
+
+#ifdef __linux
+    char *tmp = malloc(strlen(outfile) + 8);
+    if (!tmp) hndl_fatal_error("malloc");
+    sprintf(tmp, "%s.XXXXXX", outfile);
+
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        perror(outfile);
+        free(tmp);
+        return -1;
+    }
+
+    /* mkstemp makes the file 0600, give it what a plain fopen would */
+    struct stat sb;
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, stat(outfile, &sb) ? (0666 & ~mask) : (sb.st_mode & 07777));
+
+    if (len)
+        posix_fallocate(fd, 0, len);   /* a hint, fine if unsupported */
+
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, data + done, len - done);
+        if (n < 0) break;
+        done += n;
+    }
+    if (close(fd) || done < len || rename(tmp, outfile)) {
+        perror(outfile);
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+#else
+    FILE *fp = fopen(outfile, "wb");
+    if (!fp || fwrite(data, 1, len, fp) != len || fclose(fp)) {
+        perror(outfile);
+        return -1;
+    }
+#endif
+
+    STAT_STOP(write_ns, t0);
+    return 0;
+}
+
+int sane_snprintf(char **buff, int *total, int count, char *fmt, ...)
+{
+    int s, r;
+    va_list ap;
+    STAT_START(t0);
+    STAT_ADD(fmt_calls, 1);
+    va_start(ap, fmt);
+    r = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    s = r;
+    if (s+1 > (*total-count)) {
+        /* at least doubles, so a long run of writes stays linear */
+        s = (s+1 < *total) ? *total : s+1;
+        *buff = realloc(*buff, *total+s);
+        if (! *buff ) hndl_fatal_error("realloc");
+        *total += s;
+        STAT_ADD(fmt_reallocs, 1);
+    }
+
+    va_start(ap, fmt);
+    vsnprintf((*buff)+count, s+1, fmt, ap);
+    va_end(ap);
+
+    STAT_ADD(fmt_bytes, r);
+    STAT_STOP(fmt_ns, t0);
+    return r;
+}
+
+/*
+ * layer tables along relationship direction for --rank. relationships that
+ * close a cycle (dfs back edges) are flagged and ignored for layering; the
+ * rest form a dag whose longest path from a source gives each table's layer.
+ * both results are per row of the table array the graph was built on.
+ */
+void rank_tables(schema_graph *g, int nrows, int **layer, char **back)
+{
+    int *state = calloc(g->ntb+1, sizeof(int));     /* 0 new, 1 on stack, 2 done */
+    int *stk = malloc((g->ntb+1) * sizeof(int));
+    int *pos = malloc((g->ntb+1) * sizeof(int));
+    int *indeg = calloc(g->ntb+1, sizeof(int));
+    int *tb_layer = calloc(g->ntb+1, sizeof(int));
+    char *is_back = calloc(g->nrel+1, sizeof(char));
+    *layer = malloc((nrows+1) * sizeof(int));
+    *back = calloc(nrows+1, sizeof(char));
+    if (!state || !stk || !pos || !indeg || !tb_layer || !is_back || !*layer || !*back)
+        hndl_fatal_error("malloc");
+
+    int i, sp;
+    /* iterative, deep relationship chains must not overflow the stack */
+    for (i=0; i<g->ntb; i++) {
+        if (state[i]) continue;
+        sp = 0;
+        stk[sp] = i;
+        pos[sp++] = g->adj_off[i];
+        state[i] = 1;
+
+        while (sp) {
+            int t = stk[sp-1];
+            if (pos[sp-1] == g->adj_off[t+1]) {
+                state[t] = 2;
+                sp--;
+                continue;
+            }
+            int r = g->adj[pos[sp-1]++];
+            if (g->rel[r].src != t) continue;
+
+            int next = g->rel[r].dst;
+            if (state[next] == 1)
+                is_back[r] = 1;
+            else if (!state[next]) {
+                state[next] = 1;
+                stk[sp] = next;
+                pos[sp++] = g->adj_off[next];
+            }
+        }
+    }
+
+    /* longest path layering in topological order */
+    for (i=0; i<g->nrel; i++)
+        if (!is_back[i]) indeg[g->rel[i].dst]++;
+
+    int head = 0, tail = 0;
+    for (i=0; i<g->ntb; i++)
+        if (!indeg[i]) stk[tail++] = i;
+
+    while (head < tail) {
+        int t = stk[head++], k;
+        for (k = g->adj_off[t]; k < g->adj_off[t+1]; k++) {
+            int r = g->adj[k];
+            if (is_back[r] || g->rel[r].src != t) continue;
+
+            int next = g->rel[r].dst;
+            if (tb_layer[next] < tb_layer[t]+1)
+                tb_layer[next] = tb_layer[t]+1;
+            if (--indeg[next] == 0)
+                stk[tail++] = next;
+        }
+    }
+
+    for (i=0; i<nrows; i++)
+        (*layer)[i] = (g->row_tb[i] >= 0) ? tb_layer[g->row_tb[i]] : -1;
+    for (i=0; i<g->nrel; i++)
+        (*back)[g->rel[i].row] = is_back[i];
+
+    free(state);
+    free(stk);
+    free(pos);
+    free(indeg);
+    free(tb_layer);
+    free(is_back);
+}
+
+/*
+ * --bundle: group relationships by their (src, dst) table pair. per row,
+ * *lead gets the first relationship row of the group (-1 for tables) and
+ * *next chains the rows of a group together, -1 terminated.
+ */
+void bundle_rels(schema_graph *g, int nrows, int **lead, int **next)
+{
+    int size = MEM_CHUNK, i;
+    while (size < g->nrel*2)
+        size <<= 1;
+
+    long long *keys = malloc(size * sizeof(long long));
+    int *first = malloc(size * sizeof(int));
+    int *last = malloc(size * sizeof(int));
+    *lead = malloc((nrows+1) * sizeof(int));
+    *next = malloc((nrows+1) * sizeof(int));
+    if (!keys || !first || !last || !*lead || !*next)
+        hndl_fatal_error("malloc");
+
+    for (i=0; i<size; i++)
+        keys[i] = -1;
+    for (i=0; i<nrows; i++)
+        (*lead)[i] = (*next)[i] = -1;
+
+    for (i=0; i<g->nrel; i++) {
+        long long key = (long long)g->rel[i].src * g->ntb + g->rel[i].dst;
+        int slot = (int)(((unsigned long long)key * 0x9E3779B97F4A7C15ULL) >> 40) & (size-1);
+        int row = g->rel[i].row;
+
+        while (keys[slot] != -1 && keys[slot] != key)
+            slot = (slot+1) & (size-1);
+
+        if (keys[slot] == -1) {
+            keys[slot] = key;
+            first[slot] = last[slot] = row;
+        }
+        else {
+            (*next)[last[slot]] = row;
+            last[slot] = row;
+        }
+        (*lead)[row] = first[slot];
+    }
+
+    free(keys);
+    free(first);
+    free(last);
+}
+
+/* join field 2 (name) or the cardinality ends of a bundle for a label */
+char *bundle_text(node **table, int *next, int row, int field)
+{
+    char *buff = calloc(OUTBUFF_CHUNK, sizeof(char));
+    int tot = OUTBUFF_CHUNK, count = 0;
+    if (!buff) hndl_fatal_error("calloc");
+
+    for (; row >= 0; row = next[row]) {
+        const char *sep = count ? (field == 2 ? "\\n" : ",") : "";
+        if (field == 2)
+            count += sane_snprintf(&buff, &tot, count, "%s%s", sep, table[row][2].name);
+        else
+            count += sane_snprintf(&buff, &tot, count, "%s%c", sep,
+                                   field == 'f' ? table[row][3].from : table[row][3].to);
+    }
+
+    return buff;
+}
+
+/* {rank=same; ...} for every layer holding more than one table */
+int gv_rank_groups(node **table, gv_opts *opt, int *row_id, char **buff, int *tot, int count)
+{
+    int nrows, i, max = 0;
+
+    for (nrows=0; table[nrows]; nrows++)
+        if (opt->layer[nrows] > max) max = opt->layer[nrows];
+
+    /* bucket rows by layer */
+    int *start = calloc(max+2, sizeof(int));
+    int *order = malloc((nrows+1) * sizeof(int));
+    if (!start || !order)
+        hndl_fatal_error("calloc");
+    for (i=0; i<nrows; i++)
+        if (opt->layer[i] >= 0) start[opt->layer[i]+1]++;
+    for (i=0; i<=max; i++)
+        start[i+1] += start[i];
+    int *fill = malloc((max+2) * sizeof(int));
+    if (!fill) hndl_fatal_error("malloc");
+    memcpy(fill, start, (max+1) * sizeof(int));
+    for (i=0; i<nrows; i++)
+        if (opt->layer[i] >= 0) order[fill[opt->layer[i]]++] = i;
+    free(fill);
+
+    int l, k, written = 0;
+    for (l=0; l<=max; l++) {
+        if (start[l+1] - start[l] < 2) continue;
+        written += sane_snprintf(buff, tot, count+written, "{rank=same;");
+        for (k = start[l]; k < start[l+1]; k++) {
+            if (row_id)
+                written += sane_snprintf(buff, tot, count+written, " %d;", row_id[order[k]]);
+            else
+                written += sane_snprintf(buff, tot, count+written, " \"%s\";", table[order[k]][0].uname);
+        }
+        written += sane_snprintf(buff, tot, count+written, "}\n");
+    }
+
+    free(start);
+    free(order);
+    return written;
+}
+
+/* node positions from an earlier graphviz run, for --layout-from */
+struct layout_pins_t {
+    name_index idx;     /* node id -> slot */
+    char **ids;
+    double *x, *y;      /* in points */
+    int n, alloc;
+    double minx, miny;
+};
+
+typedef struct layout_pins_t layout_pins;
+
+void pins_add(layout_pins *lp, char *id, double x, double y)
+{
+    if (nidx_lookup(&lp->idx, id) >= 0) return;
+
+    if (lp->n == lp->alloc) {
+        lp->alloc = lp->alloc ? lp->alloc*2 : OUTBUFF_CHUNK;
+        lp->ids = realloc(lp->ids, lp->alloc * sizeof(char *));
+        lp->x = realloc(lp->x, lp->alloc * sizeof(double));
+        lp->y = realloc(lp->y, lp->alloc * sizeof(double));
+        if (!lp->ids || !lp->x || !lp->y)
+            hndl_fatal_error("realloc");
+    }
+    lp->ids[lp->n] = strdup(id);
+    if (!lp->ids[lp->n]) hndl_fatal_error("strdup");
+    lp->x[lp->n] = x;
+    lp->y[lp->n] = y;
+    nidx_insert(&lp->idx, lp->ids[lp->n], lp->n);
+    if (!lp->n || x < lp->minx) lp->minx = x;
+    if (!lp->n || y < lp->miny) lp->miny = y;
+    lp->n++;
+}
+
+void free_pins(layout_pins *lp)
+{
+    int i;
+    for (i=0; i<lp->n; i++)
+        free(lp->ids[i]);
+    free(lp->ids);
+    free(lp->x);
+    free(lp->y);
+    nidx_free(&lp->idx);
+}
+
+/*
+ * next token of graphviz text into tok. returns 'i' for an id (quotes and
+ * escapes removed), 'e' for an edge operator, 'p' for any other single
+ * character and 0 at the end.
+ */
+int gv_token(char **p, char *tok)
+{
+    char *s = *p;
+
+    for (;;) {
+        while (isspace((unsigned char)*s))
+            s++;
+        if (s[0] == '/' && s[1] == '/')
+            while (*s && *s != '\n') s++;
+        else if (s[0] == '/' && s[1] == '*') {
+            char *e = strstr(s+2, "*/");
+            s = e ? e+2 : s+strlen(s);
+        }
+        else if (*s == '#')
+            while (*s && *s != '\n') s++;
+        else break;
+    }
+    if (!*s || *s == EOF) {
+        *p = s;
+        return 0;
+    }
+
+    int kind = 'i';
+    if (*s == '"') {
+        for (s++; *s && *s != '"'; s++) {
+            if (*s == '\\' && s[1] == '\n') { s++; continue; }
+            if (*s == '\\' && s[1] == '"') s++;
+            *tok++ = *s;
+        }
+        if (*s) s++;
+    }
+    else if (*s == '<') {   /* html string, kept whole */
+        int depth = 0;
+        do {
+            if (*s == '<') depth++;
+            else if (*s == '>') depth--;
+            *tok++ = *s++;
+        } while (*s && depth);
+    }
+    else if ((s[0] == '-' && (s[1] == '-' || s[1] == '>'))) {
+        *tok++ = *s++;
+        *tok++ = *s++;
+        kind = 'e';
+    }
+    else if (isalnum((unsigned char)*s) || *s == '_' || *s == '.' || *s == '-' || (*s & 0x80)) {
+        while (isalnum((unsigned char)*s) || *s == '_' || *s == '.' || *s == '-' || (*s & 0x80 && *s != EOF))
+            *tok++ = *s++;
+    }
+    else {
+        *tok++ = *s++;
+        kind = 'p';
+    }
+
+    *tok = 0;
+    *p = s;
+    return kind;
+}
+
+/*
+ * read node positions from `dot -Tplain` output (inches) or from dot/xdot
+ * output (pos attributes, points). returns the number of positions read,
+ * -1 if file can't be read.
+ */
+int load_layout(const char *file, layout_pins *lp)
+{
+    memset(lp, 0, sizeof(layout_pins));
+    char *mem = read_file_into_mem(file);
+    if (!mem) return -1;
+    char *tok = malloc(strlen(mem)+1);
+    char *p = mem;
+    if (!tok) hndl_fatal_error("malloc");
+
+    nidx_init(&lp->idx, OUTBUFF_CHUNK);
+
+    if (!strncmp(mem, "graph ", 6) && isdigit((unsigned char)mem[6])) {
+        /* plain: node name x y width height label ... */
+        while (*p && *p != EOF) {
+            if (!strncmp(p, "node ", 5)) {
+                char *name;
+                double x = 0, y = 0;
+
+                p += 5;
+                gv_token(&p, tok);
+                name = strdup(tok);
+                if (!name) hndl_fatal_error("strdup");
+                if (gv_token(&p, tok)) x = atof(tok) * 72;
+                if (gv_token(&p, tok)) y = atof(tok) * 72;
+                pins_add(lp, name, x, y);
+                free(name);
+            }
+            while (*p && *p != EOF && *p != '\n')
+                p++;
+            if (*p == '\n') p++;
+        }
+    }
+    else {
+        /* dot/xdot: pick pos out of node statements */
+        char *id = NULL, *key = NULL;
+        int ids = 0;
+        bool edge = false, attrs = false, after_eq = false, port = false;
+
+        int kind;
+        while ( (kind = gv_token(&p, tok)) ) {
+            bool is_id = (kind == 'i');
+            if (kind == 'e') {
+                edge = true;
+                continue;
+            }
+            if (attrs) {
+                if (!is_id && !strcmp(tok, "]")) {
+                    attrs = false;
+                    ids = 0;
+                    edge = false;
+                }
+                else if (!is_id && !strcmp(tok, "="))
+                    after_eq = true;
+                else if (after_eq) {
+                    double x, y;
+                    if (id && key && !strcmp(key, "pos") && sscanf(tok, "%lf,%lf", &x, &y) == 2)
+                        pins_add(lp, id, x, y);
+                    after_eq = false;
+                }
+                else if (is_id) {
+                    free(key);
+                    key = strdup(tok);
+                }
+                continue;
+            }
+
+            if (is_id) {
+                if (port || after_eq) {
+                    port = after_eq = false;
+                    continue;
+                }
+                if (!edge && ids) ids = 0;  /* statements need no ';' */
+                if (!edge && (!strcmp(tok, "graph") || !strcmp(tok, "node") || !strcmp(tok, "edge")
+                              || !strcmp(tok, "subgraph") || !strcmp(tok, "digraph") || !strcmp(tok, "strict"))) {
+                    ids = 2;    /* never a node statement */
+                    continue;
+                }
+                free(id);
+                id = strdup(tok);
+                ids++;
+            }
+            else if (!strcmp(tok, "[")) {
+                attrs = true;
+                after_eq = false;
+                if (ids != 1 || edge) {
+                    free(id);
+                    id = NULL;
+                }
+            }
+            else if (!strcmp(tok, "=")) {
+                after_eq = true;
+                ids = 0;
+            }
+            else if (!strcmp(tok, ":"))
+                port = true;
+            else {  /* ; { } */
+                ids = 0;
+                edge = false;
+            }
+        }
+        free(id);
+        free(key);
+    }
+
+    free(tok);
+    free(mem);
+    return lp->n;
+}
+
+/*
+ * pos attribute for a node under --layout-from: its earlier position, pinned,
+ * or (*x, *y) as the starting point for a node that is new.
+ */
+void pin_attr(layout_pins *lp, const char *id, double *x, double *y, char *attr)
+{
+    attr[0] = 0;
+    if (!lp) return;
+
+    int k = nidx_lookup(&lp->idx, id);
+    if (k >= 0) {
+        *x = lp->x[k];
+        *y = lp->y[k];
+        snprintf(attr, MAX_ERR_LEN, ",pos=\"%.2f,%.2f!\"", *x, *y);
+    }
+    else
+        snprintf(attr, MAX_ERR_LEN, ",pos=\"%.2f,%.2f\"", *x, *y);
+}
+
+/* stable ids for relationship nodes: src>dst/name, #n on repeats */
+char **gv_rel_ids(node **table)
+{
+    int nrows, i;
+    for (nrows=0; table[nrows]; nrows++)
+        ;
+
+    char **ids = calloc(nrows+1, sizeof(char *));
+    if (!ids) hndl_fatal_error("calloc");
+    name_index seen;
+    nidx_init(&seen, nrows);
+
+    for (i=0; i<nrows; i++) {
+        if (table[i][0].type != REL_SPEC) continue;
+
+        int len = strlen(table[i][0].name) + strlen(table[i][1].name) + strlen(table[i][2].name) + 3;
+        int n = 1;
+        ids[i] = calloc(len+12, sizeof(char));
+        if (!ids[i]) hndl_fatal_error("calloc");
+        snprintf(ids[i], len, "%s>%s/%s", table[i][0].name, table[i][1].name, table[i][2].name);
+        while (nidx_insert(&seen, ids[i], i) >= 0)
+            snprintf(ids[i]+len-1, 12, "#%d", n++);
+    }
+
+    nidx_free(&seen);
+    return ids;
+}
+
+/* true if s can be written as an unquoted graphviz ID */
+bool gv_plain_id(const char *s)
+{
+    static const char *kw[] = { "node", "edge", "graph", "digraph", "subgraph", "strict", NULL };
+    const char *p = s;
+    int k;
+
+    if (!*p || isdigit((unsigned char)*p)) return false;
+    for (; *p; p++)
+        if (!isalnum((unsigned char)*p) && *p != '_') return false;
+    for (k=0; kw[k]; k++)
+        if (!strcasecmp(s, kw[k])) return false;
+
+    return true;
+}
+
+/*
+ * --compact: numeric node ids, shared default attributes, edge sets.
+ * all tables are written first so the relationship edge defaults only
+ * need to be set once.
+ */
+/* extra attributes of node j of row i under --diff, for nodes and edges alike */
+const char *diff_style(gv_opts *opt, int i, int j)
+{
+    if (!opt->diff || !opt->diff[i]) return "";
+    switch (opt->diff[i][j]) {
+    case DIFF_ADDED:   return ",color=forestgreen,fontcolor=forestgreen";
+    case DIFF_REMOVED: return ",color=gray55,fontcolor=gray55,style=dashed";
+    case DIFF_CHANGED: return ",color=darkorange,fontcolor=darkorange";
+    }
+    return "";
+}
+
+/*
+ * extra edge attributes of relationship row i into buf, --diff included,
+ * each attribute once. red asks for the plain edge color, which a --diff
+ * color replaces.
+ */
+#define EDGE_STYLE_LEN 96
+const char *edge_style(gv_opts *opt, int i, bool red, char *buf)
+{
+    static const char *color[] = { "red", "forestgreen", "gray55", "darkorange" };  /* as diff_style */
+    enum diff_state st = opt->diff && opt->diff[i] ? opt->diff[i][0] : DIFF_SAME;
+    int n = 0;
+
+    if (red || st != DIFF_SAME)
+        n += sprintf(buf+n, ",color=%s", color[st]);
+    if (opt->back && opt->back[i])
+        n += sprintf(buf+n, ",constraint=false");
+    if (st == DIFF_REMOVED || (opt->inferred && opt->inferred[i]))
+        n += sprintf(buf+n, ",style=dashed");
+    if (st != DIFF_SAME)
+        n += sprintf(buf+n, ",fontcolor=%s", color[st]);
+    buf[n] = 0;
+    return buf;
+}
+
+int write_gv_compact(node **table, out_buf *ob, gv_opts *opt)
+{
+    char *outbuff = calloc(OUTBUFF_CHUNK, sizeof(char));
+    int tot_alloc = OUTBUFF_CHUNK;
+    int nrows, i, j, count = 0, id = 0, rel_indx = 0;
+
+    for (nrows=0; table[nrows]; nrows++)
+        ;
+    int *row_id = malloc((nrows+1) * sizeof(int));
+    if (!outbuff || !row_id)
+        hndl_fatal_error("malloc");
+    name_index by_name;
+    nidx_init(&by_name, nrows);
+
+    count += sane_snprintf(&outbuff, &tot_alloc, count, "node [shape=oval];\n");
+    for (i=0; table[i]; i++) {
+        if (table[i][0].type != TB_SPEC) continue;
+
+        row_id[i] = id;
+        nidx_insert(&by_name, table[i][0].name, i);
+        count += sane_snprintf(&outbuff, &tot_alloc, count,
+                               gv_plain_id(table[i][0].name) ? "subgraph %s {\n%d [label=%s,shape=box%s];\n"
+                                                             : "subgraph \"%s\" {\n%d [label=\"%s\",shape=box%s];\n",
+                               table[i][0].name, id, table[i][0].name, diff_style(opt, i, 0));
+        for (j=1; table[i][j].name; j++)
+            count += sane_snprintf(&outbuff, &tot_alloc, count,
+                                   gv_plain_id(table[i][j].name) ? "%d [label=%s%s];\n" : "%d [label=\"%s\"%s];\n",
+                                   id+j, table[i][j].name, diff_style(opt, i, j));
+        if (j > 1) {
+            count += sane_snprintf(&outbuff, &tot_alloc, count, "%d -- {", id);
+            for (j=1; table[i][j].name; j++)
+                count += sane_snprintf(&outbuff, &tot_alloc, count, j > 1 ? " %d" : "%d", id+j);
+            count += sane_snprintf(&outbuff, &tot_alloc, count, "};\n");
+        }
+        if (opt->elided && opt->elided[i])
+            count += sane_snprintf(&outbuff, &tot_alloc, count, "m%d [label=\"+%d\",shape=plaintext];\n%d -- m%d [style=dashed];\n",
+                                   id, opt->elided[i], id, id);
+        count += sane_snprintf(&outbuff, &tot_alloc, count, "}\n");
+        id += j;
+
+        out_write(outbuff, count, ob);
+        count = 0;
+    }
+
+    count += sane_snprintf(&outbuff, &tot_alloc, count, "edge [labeldistance=2,color=red];\n");
+    for (i=0; table[i]; i++) {
+        if (table[i][0].type != REL_SPEC) continue;
+
+        int src = nidx_lookup(&by_name, table[i][0].name);
+        int dst = nidx_lookup(&by_name, table[i][1].name);
+        if (src < 0 || dst < 0) {
+            qerr("Unknown table in relationship %d : \"%s\" -> \"%s\"\nTable \"%s\" not defined\n",
+                    rel_indx+1, table[i][0].name, table[i][1].name,
+                    (src >= 0 ? table[i][1].name : table[i][0].name));
+            nidx_free(&by_name);
+            free(row_id);
+            free(outbuff);
+            return -1;
+        }
+        char ebuf[EDGE_STYLE_LEN];
+        const char *e = edge_style(opt, i, false, ebuf), *d = diff_style(opt, i, 0);
+        if (opt->bundle_lead && opt->bundle_lead[i] != i)
+            continue;   /* written with its bundle */
+        if (opt->bundle_lead && opt->bundle_next[i] >= 0) {
+            char *label = bundle_text(table, opt->bundle_next, i, 2);
+            char *from = bundle_text(table, opt->bundle_next, i, 'f');
+            char *to = bundle_text(table, opt->bundle_next, i, 't');
+            count += sane_snprintf(&outbuff, &tot_alloc, count, "r%d [label=\"%s\",shape=diamond%s];\n"
+                                   "%d -- r%d [headport=n,headlabel=\"%s\"%s];\nr%d -- %d [tailport=s,taillabel=\"%s\"%s];\n",
+                                   rel_indx, label, d, row_id[src], rel_indx, from, e, rel_indx, row_id[dst], to, e);
+            free(label);
+            free(from);
+            free(to);
+        }
+        else {
+            count += sane_snprintf(&outbuff, &tot_alloc, count,
+                                   gv_plain_id(table[i][2].name) ? "r%d [label=%s,shape=diamond%s];\n"
+                                                                 : "r%d [label=\"%s\",shape=diamond%s];\n",
+                                   rel_indx, table[i][2].name, d);
+            count += sane_snprintf(&outbuff, &tot_alloc, count, "%d -- r%d [headport=n,headlabel=%c%s];\nr%d -- %d [tailport=s,taillabel=%c%s];\n",
+                                   row_id[src], rel_indx, table[i][3].from, e, rel_indx, row_id[dst], table[i][3].to, e);
+        }
+        rel_indx++;
+
+        if (count > OUTBUFF_CHUNK*4) {
+            out_write(outbuff, count, ob);
+            count = 0;
+        }
+    }
+    if (opt->layer)
+        count += gv_rank_groups(table, opt, row_id, &outbuff, &tot_alloc, count);
+    out_write(outbuff, count, ob);
+
+    nidx_free(&by_name);
+    free(row_id);
+    free(outbuff);
+    return 0;
+}
+
+/* graphviz text for table into ob. returns -1 if a relationship can't be resolved */
+int render_gv(node **table, gv_opts *opt, out_buf *ob)
+{
+    const char *initial = "graph main {\n\
+    ranksep=0.75;\n\
+    rankdir=TB;\n\
+    layout=dot;\n\
+    constraint=true;\n\
+    ";
+
+    out_write(initial, strlen(initial), ob);
+
+    if (opt->compact) {
+        if (write_gv_compact(table, ob, opt) < 0)
+            return -1;
+        out_write("}", 1, ob);
+        return 0;
+    }
+
+    char *outbuff = calloc(OUTBUFF_CHUNK, sizeof(char));
+    int tot_alloc = OUTBUFF_CHUNK;
+    int i, j, count=0;
+    int rel_indx = 0;
+    char **rel_id = gv_rel_ids(table);
+    char pos[MAX_ERR_LEN];
+    double *tx = NULL, *ty = NULL, x, y;
+    name_index by_name;
+
+    int nrows;
+    for (nrows=0; table[nrows]; nrows++)
+        ;
+    nidx_init(&by_name, nrows);
+    for (i=0; table[i]; i++)
+        if (table[i][0].type == TB_SPEC)
+            nidx_insert(&by_name, table[i][0].name, i);
+
+    if (opt->pins) {
+        /* tables first, new nodes start out next to what they belong to */
+        int fresh = 0;
+        tx = malloc((nrows+1) * sizeof(double));
+        ty = malloc((nrows+1) * sizeof(double));
+        if (!tx || !ty) hndl_fatal_error("malloc");
+
+        for (i=0; table[i]; i++) {
+            if (table[i][0].type != TB_SPEC) continue;
+            tx[i] = opt->pins->minx + NEW_NODE_GAP*3*fresh;
+            ty[i] = opt->pins->miny - NEW_NODE_GAP*3;
+            if (nidx_lookup(&opt->pins->idx, table[i][0].uname) < 0)
+                fresh++;
+            pin_attr(opt->pins, table[i][0].uname, &tx[i], &ty[i], pos);
+        }
+        count += sane_snprintf(&outbuff, &tot_alloc, count, "layout=neato;\n    overlap=false;\n    splines=true;\n");
+    }
+
+    for (i=0; table[i]; i++) {
+        if (table[i][0].type == TB_SPEC) {
+            if (opt->pins)
+                x = tx[i], y = ty[i];
+            pin_attr(opt->pins, table[i][0].uname, &x, &y, pos);
+            count += sane_snprintf(&outbuff, &tot_alloc, count, "\nsubgraph \"%s\" {\nnode [shape=oval]\n",
+                             table[i][0].name);
+            count += sane_snprintf(&outbuff, &tot_alloc, count, "\"%s\" [label=\"%s\",shape=box%s%s];\n",
+                              table[i][0].uname, table[i][0].name, pos, diff_style(opt, i, 0));
+            for (j=1; table[i][j].name; j++) {
+                if (opt->pins) {
+                    x = tx[i] + NEW_NODE_GAP*((j-1)%4 - 1.5);
+                    y = ty[i] - NEW_NODE_GAP*(1 + (j-1)/4);
+                }
+                pin_attr(opt->pins, table[i][j].uname, &x, &y, pos);
+                count += sane_snprintf(&outbuff, &tot_alloc, count, "\"%s\" [label=\"%s\"%s%s];\n",
+                                  table[i][j].uname, table[i][j].name, pos, diff_style(opt, i, j));
+
+            }
+            for (j=1; table[i][j].name; j++) {
+                const char *d = diff_style(opt, i, j);
+                count += sane_snprintf(&outbuff, &tot_alloc, count, *d ? "\"%s\" -- \"%s\" [%s];\n" : "\"%s\" -- \"%s\";\n",
+                                  table[i][0].uname, table[i][j].uname, d+1);
+            }
+            if (opt->elided && opt->elided[i]) {
+                /* relationships to tables outside the focus */
+                if (opt->pins) {
+                    char *more = malloc(strlen(table[i][0].uname)+3);
+                    if (!more) hndl_fatal_error("malloc");
+                    sprintf(more, "%s/+", table[i][0].uname);
+                    x = tx[i] + NEW_NODE_GAP, y = ty[i] + NEW_NODE_GAP/2;
+                    pin_attr(opt->pins, more, &x, &y, pos);
+                    free(more);
+                }
+                count += sane_snprintf(&outbuff, &tot_alloc, count, "\"%s/+\" [label=\"+%d\",shape=plaintext%s];\n",
+                                  table[i][0].uname, opt->elided[i], pos);
+                count += sane_snprintf(&outbuff, &tot_alloc, count, "\"%s\" -- \"%s/+\" [style=dashed];\n",
+                                  table[i][0].uname, table[i][0].uname);
+            }
+            count += sane_snprintf(&outbuff, &tot_alloc, count, "}\n");
+            out_write(outbuff, count, ob);
+            count = 0;
+        }
+        else if (table[i][0].type == REL_SPEC) {
+            char *src = get_uname(table, &by_name, table[i][0].name);
+            char *dst = get_uname(table, &by_name, table[i][1].name);
+
+            if (opt->bundle_lead && opt->bundle_lead[i] != i)
+                continue;   /* written with its bundle */
+
+            if (src && dst && opt->pins) {
+                int s = nidx_lookup(&by_name, table[i][0].name);
+                int d = nidx_lookup(&by_name, table[i][1].name);
+                x = (tx[s] + tx[d]) / 2;
+                y = (ty[s] + ty[d]) / 2;
+            }
+            pin_attr(opt->pins, rel_id[i], &x, &y, pos);
+
+            if (src && dst && opt->bundle_lead && opt->bundle_next[i] >= 0) {
+                char ebuf[EDGE_STYLE_LEN];
+                const char *e = edge_style(opt, i, true, ebuf), *d = diff_style(opt, i, 0);
+                char *label = bundle_text(table, opt->bundle_next, i, 2);
+                char *from = bundle_text(table, opt->bundle_next, i, 'f');
+                char *to = bundle_text(table, opt->bundle_next, i, 't');
+
+                count += sane_snprintf(&outbuff, &tot_alloc, count, "\n\"%s\" [label=\"%s\", shape=diamond%s%s];\n",
+                                  rel_id[i], label, pos, d);
+                count += sane_snprintf(&outbuff, &tot_alloc, count, "\"%s\" -- \"%s\" [headport=n,headlabel=\"%s\",labeldistance=2%s];\n",
+                                  src, rel_id[i], from, e);
+                count += sane_snprintf(&outbuff, &tot_alloc, count, "\"%s\" -- \"%s\" [tailport=s,taillabel=\"%s\",labeldistance=2%s];\n",
+                                  rel_id[i], dst, to, e);
+                free(label);
+                free(from);
+                free(to);
+
+                out_write(outbuff, count, ob);
+                count = 0;
+                rel_indx++;
+            }
+            else if (src && dst) {
+                char ebuf[EDGE_STYLE_LEN];
+                const char *e = edge_style(opt, i, true, ebuf), *d = diff_style(opt, i, 0);
+                count += sane_snprintf(&outbuff, &tot_alloc, count, "\n\"%s\" [label=\"%s\", shape=diamond%s%s];\n",
+                                  rel_id[i], table[i][2].name, pos, d);
+                count += sane_snprintf(&outbuff, &tot_alloc, count, "\"%s\" -- \"%s\" [headport=n,headlabel=%c,labeldistance=2%s];\n",
+                                  src, rel_id[i], table[i][3].from, e);
+                count += sane_snprintf(&outbuff, &tot_alloc, count, "\"%s\" -- \"%s\" [tailport=s,taillabel=%c,labeldistance=2%s];\n",
+                                  rel_id[i], dst, table[i][3].to, e);
+
+                out_write(outbuff, count, ob);
+                count = 0;
+                rel_indx++;
+            }
+            else { qerr("Unknown table in relationship %d : \"%s\" -> \"%s\"\nTable \"%s\" not defined\n",
+                         rel_indx+1, table[i][0].name, table[i][1].name,
+                         (src ? table[i][1].name : table[i][0].name));
+                    break;
+            }
+        }
+    }
+    if (!table[i]) {
+        if (opt->layer) {
+            count = gv_rank_groups(table, opt, NULL, &outbuff, &tot_alloc, 0);
+            out_write(outbuff, count, ob);
+        }
+        out_write("}", 1, ob); /* brings closure*/
+    }
+    int ret = table[i] ? -1 : 0;
+
+    nidx_free(&by_name);
+    if (opt->pins) {
+        free(tx);
+        free(ty);
+    }
+    for (i=0; table[i]; i++)
+        free(rel_id[i]);
+    free(rel_id);
+    free(outbuff);
+    return ret;
+}
+
+/*
+ * --diff: one model holding both versions of a description. the rows of
+ * the new one come first, in their order, then whatever only the old one
+ * has, marked removed; columns only the old table has are put back at
+ * the end of the table's row. tables and columns are matched by uname,
+ * relationships by node id, through one hash index per version, so the
+ * pass is linear. (*marks)[i][j] is the DIFF_ state of node j of row i.
+ * the rows are new arrays, the names still belong to old and new.
+ */
+node **diff_model(node **old, node **new, char ***marks)
+{
+    node **ver[2] = { old, new };
+    char **rel_id[2];
+    name_index idx[2];
+    int nrows[2], v, i, j, n = 0;
+
+    for (v=0; v<2; v++) {
+        int ncols = 0;
+        for (nrows[v]=0; ver[v][nrows[v]]; nrows[v]++)
+            for (j=0; ver[v][nrows[v]][j].name; j++)
+                ncols++;
+
+        rel_id[v] = gv_rel_ids(ver[v]);
+        nidx_init(&idx[v], ncols);
+        for (i=0; i<nrows[v]; i++) {
+            node *row = ver[v][i];
+            if (row[0].type == REL_SPEC)
+                nidx_insert(&idx[v], rel_id[v][i], i);
+            else
+                for (j=0; row[j].name; j++)
+                    nidx_insert(&idx[v], row[j].uname, i);
+        }
+    }
+
+    node **merged = calloc(nrows[0]+nrows[1]+1, sizeof(node *));
+    char **mk = calloc(nrows[0]+nrows[1]+1, sizeof(char *));
+    if (!merged || !mk) hndl_fatal_error("calloc");
+
+    for (i=0; i<nrows[1]; i++) {
+        node *row = new[i];
+        int width, gone = 0, k;
+        for (width=0; row[width].name; width++)
+            ;
+
+        int o = nidx_lookup(&idx[0], row[0].type == REL_SPEC ? rel_id[1][i] : row[0].uname);
+        if (o >= 0 && row[0].type == TB_SPEC)
+            for (j=1; old[o][j].name; j++)
+                if (nidx_lookup(&idx[1], old[o][j].uname) < 0)
+                    gone++;
+
+        merged[n] = calloc(width+gone+1, sizeof(node));
+        mk[n] = calloc(width+gone+1, sizeof(char));
+        if (!merged[n] || !mk[n]) hndl_fatal_error("calloc");
+        memcpy(merged[n], row, width * sizeof(node));
+
+        if (o < 0)
+            memset(mk[n], DIFF_ADDED, width);
+        else if (row[0].type == REL_SPEC) {
+            if (row[3].from != old[o][3].from || row[3].to != old[o][3].to)
+                memset(mk[n], DIFF_CHANGED, width);
+        }
+        else {
+            bool changed = (gone > 0);
+            for (j=1; j<width; j++)
+                if (nidx_lookup(&idx[0], row[j].uname) < 0)
+                    mk[n][j] = DIFF_ADDED, changed = true;
+            for (j=1, k=width; old[o][j].name; j++)
+                if (nidx_lookup(&idx[1], old[o][j].uname) < 0) {
+                    merged[n][k] = old[o][j];
+                    mk[n][k++] = DIFF_REMOVED;
+                }
+            if (changed)
+                mk[n][0] = DIFF_CHANGED;
+        }
+        n++;
+    }
+
+    for (i=0; i<nrows[0]; i++) {
+        node *row = old[i];
+        int width;
+
+        if (nidx_lookup(&idx[1], row[0].type == REL_SPEC ? rel_id[0][i] : row[0].uname) >= 0)
+            continue;
+        for (width=0; row[width].name; width++)
+            ;
+        merged[n] = calloc(width+1, sizeof(node));
+        mk[n] = malloc(width+1);
+        if (!merged[n] || !mk[n]) hndl_fatal_error("malloc");
+        memcpy(merged[n], row, width * sizeof(node));
+        memset(mk[n], DIFF_REMOVED, width+1);
+        n++;
+    }
+    merged[n] = NULL;
+
+    for (v=0; v<2; v++) {
+        for (i=0; i<nrows[v]; i++)
+            free(rel_id[v][i]);
+        free(rel_id[v]);
+        nidx_free(&idx[v]);
+    }
+    *marks = mk;
+    return merged;
+}
+
+void free_diff(node **merged, char **marks)
+{
+    int i;
+
+    for (i=0; merged[i]; i++) {
+        free(merged[i]);
+        free(marks[i]);
+    }
+    free(merged);
+    free(marks);
+}
+
+/* --changed: what changed, as a --focus list */
+char *diff_focus(node **merged, char **marks)
+{
+    out_buf ob = { NULL, 0, 0 };
+    int i, k;
+
+    for (i=0; merged[i]; i++) {
+        if (!marks[i][0]) continue;
+        for (k=0; k < (merged[i][0].type == REL_SPEC ? 2 : 1); k++) {
+            if (ob.len) out_write(",", 1, &ob);
+            out_write(merged[i][k].name, strlen(merged[i][k].name), &ob);
+        }
+    }
+    out_write("", 1, &ob);
+    return ob.data;
+}
+
+/*
+ * other output formats. they get the same view of the model as render_gv
+ * (--focus, --infer, --diff) and skip what only makes sense to graphviz.
+ */
+
+/* index of the tables by name; -1 after reporting a relationship to a missing one */
+int index_tables(node **table, name_index *by_name)
+{
+    int nrows, i, rel_indx = 0;
+
+    for (nrows=0; table[nrows]; nrows++)
+        ;
+    nidx_init(by_name, nrows);
+    for (i=0; table[i]; i++)
+        if (table[i][0].type == TB_SPEC)
+            nidx_insert(by_name, table[i][0].name, i);
+
+    for (i=0; table[i]; i++) {
+        if (table[i][0].type != REL_SPEC) continue;
+        bool src = nidx_lookup(by_name, table[i][0].name) >= 0;
+        bool dst = nidx_lookup(by_name, table[i][1].name) >= 0;
+        if (!src || !dst) {
+            qerr("Unknown table in relationship %d : \"%s\" -> \"%s\"\nTable \"%s\" not defined\n",
+                    rel_indx+1, table[i][0].name, table[i][1].name,
+                    (src ? table[i][1].name : table[i][0].name));
+            nidx_free(by_name);
+            return -1;
+        }
+        rel_indx++;
+    }
+    return 0;
+}
+
+/* crow's foot end of a relationship, for mermaid and plantuml */
+const char *crow_end(char card, bool left)
+{
+    if (card == '1') return "||";
+    return left ? "}o" : "o{";
+}
+
+/* mermaid names are a single word */
+char mermaid_char(char c)
+{
+    return (isalnum((unsigned char)c) || c == '_' || c == '-' || (c & 0x80)) ? c : '_';
+}
+
+void write_word(const char *s, out_buf *ob)
+{
+    char w[MAX_ERR_LEN];
+    int n = 0;
+
+    for (; *s; s++) {
+        w[n++] = mermaid_char(*s);
+        if (n == sizeof(w)) {
+            out_write(w, n, ob);
+            n = 0;
+        }
+    }
+    out_write(w, n, ob);
+}
+
+/*
+ * the mermaid entity of each table row, NULL for other rows. names that
+ * only differ in what write_word replaces would be one entity, so the
+ * later ones get a suffix, as gv_rel_ids does.
+ */
+char **mermaid_ids(node **table)
+{
+    int nrows, i;
+
+    for (nrows=0; table[nrows]; nrows++)
+        ;
+
+    char **ids = calloc(nrows+1, sizeof(char *));
+    if (!ids) hndl_fatal_error("calloc");
+    name_index seen;
+    nidx_init(&seen, nrows);
+
+    for (i=0; i<nrows; i++) {
+        if (table[i][0].type != TB_SPEC) continue;
+
+        int len = strlen(table[i][0].name), k, n = 2;
+        ids[i] = malloc(len+13);
+        if (!ids[i]) hndl_fatal_error("malloc");
+        for (k=0; k<len; k++)
+            ids[i][k] = mermaid_char(table[i][0].name[k]);
+        ids[i][len] = 0;
+        while (nidx_insert(&seen, ids[i], i) >= 0)
+            snprintf(ids[i]+len, 13, "_%d", n++);
+    }
+
+    nidx_free(&seen);
+    return ids;
+}
+
+/*
+ * --emit mermaid: an erDiagram. the first column is the key. mermaid
+ * wants a type before every attribute name and the description has
+ * none, so each column is given the placeholder type col.
+ */
+int render_mermaid(node **table, gv_opts *opt, out_buf *ob)
+{
+    char line[MAX_ERR_LEN];
+    name_index by_name;
+    int i, j, n;
+
+    (void)opt;
+    if (index_tables(table, &by_name) < 0)
+        return -1;
+
+    char **ids = mermaid_ids(table);
+
+    out_write("erDiagram\n", 10, ob);
+    for (i=0; table[i]; i++) {
+        if (table[i][0].type != TB_SPEC) continue;
+        out_write("    ", 4, ob);
+        out_write(ids[i], strlen(ids[i]), ob);
+        out_write(" {\n", 3, ob);
+        for (j=1; table[i][j].name; j++) {
+            out_write("        col ", 12, ob);
+            write_word(table[i][j].name, ob);
+            out_write(j == 1 ? " PK\n" : "\n", j == 1 ? 4 : 1, ob);
+        }
+        out_write("    }\n", 6, ob);
+    }
+    for (i=0; table[i]; i++) {
+        if (table[i][0].type != REL_SPEC) continue;
+        char *src = ids[nidx_lookup(&by_name, table[i][0].name)];
+        char *dst = ids[nidx_lookup(&by_name, table[i][1].name)];
+        out_write("    ", 4, ob);
+        out_write(src, strlen(src), ob);
+        n = snprintf(line, sizeof(line), " %s--%s ", crow_end(table[i][3].from, true),
+                     crow_end(table[i][3].to, false));
+        out_write(line, n, ob);
+        out_write(dst, strlen(dst), ob);
+        out_write(" : \"", 4, ob);
+        out_write(table[i][2].name, strlen(table[i][2].name), ob);
+        out_write("\"\n", 2, ob);
+    }
+
+    for (i=0; table[i]; i++)
+        free(ids[i]);
+    free(ids);
+    nidx_free(&by_name);
+    return 0;
+}
+
+/* --emit plantuml: entities in IE notation, the key above the line */
+int render_plantuml(node **table, gv_opts *opt, out_buf *ob)
+{
+    char *outbuff = calloc(OUTBUFF_CHUNK, sizeof(char));
     int tot_alloc = OUTBUFF_CHUNK;
-    int i, j, count=0;
-    int rel_indx = 0;
-    
+    int i, j, count = 0;
+    name_index by_name;
+
+    (void)opt;
+    if (!outbuff) hndl_fatal_error("calloc");
+    if (index_tables(table, &by_name) < 0) {
+        free(outbuff);
+        return -1;
+    }
+
+    count += sane_snprintf(&outbuff, &tot_alloc, count, "@startuml\nhide circle\nskinparam linetype ortho\n");
     for (i=0; table[i]; i++) {
-        if (table[i][0].type == TB_SPEC) {
-            count += sane_snprintf(&outbuff, &tot_alloc, count, "\nsubgraph \"%s\" {\nnode [shape=oval]\n",
-                             table[i][0].name);
-            count += sane_snprintf(&outbuff, &tot_alloc, count, "\"%s\" [label=\"%s\",shape=box];\n",
-                              table[i][0].uname, table[i][0].name);
-            for (j=1; table[i][j].name; j++) {
-                count += sane_snprintf(&outbuff, &tot_alloc, count, "\"%s\" [label=\"%s\"];\n",
-                                  table[i][j].uname, table[i][j].name);
+        if (table[i][0].type != TB_SPEC) continue;
+        count += sane_snprintf(&outbuff, &tot_alloc, count, "\nentity \"%s\" as t%d {\n", table[i][0].name, i);
+        for (j=1; table[i][j].name; j++)
+            count += sane_snprintf(&outbuff, &tot_alloc, count, j == 1 ? "  * %s\n  --\n" : "  %s\n",
+                                   table[i][j].name);
+        count += sane_snprintf(&outbuff, &tot_alloc, count, "}\n");
+        out_write(outbuff, count, ob);
+        count = 0;
+    }
+    for (i=0; table[i]; i++) {
+        if (table[i][0].type != REL_SPEC) continue;
+        count += sane_snprintf(&outbuff, &tot_alloc, count, "t%d %s--%s t%d : %s\n",
+                               nidx_lookup(&by_name, table[i][0].name), crow_end(table[i][3].from, true),
+                               crow_end(table[i][3].to, false), nidx_lookup(&by_name, table[i][1].name),
+                               table[i][2].name);
+        if (count > OUTBUFF_CHUNK*4) {
+            out_write(outbuff, count, ob);
+            count = 0;
+        }
+    }
+    count += sane_snprintf(&outbuff, &tot_alloc, count, "@enduml\n");
+    out_write(outbuff, count, ob);
+
+    nidx_free(&by_name);
+    free(outbuff);
+    return 0;
+}
+
+void json_str(const char *s, out_buf *ob)
+{
+    const char *run = s;
+    char esc[8];
+
+    out_write("\"", 1, ob);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c != '"' && c != '\\' && c >= 0x20) continue;
+        out_write(run, s - run, ob);
+        if (c < 0x20)
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+        else
+            esc[0] = '\\', esc[1] = c, esc[2] = '\0';
+        out_write(esc, strlen(esc), ob);
+        run = s+1;
+    }
+    out_write(run, s - run, ob);
+    out_write("\"", 1, ob);
+}
+
+/* ,"change":"added" for node j of row i under --diff */
+void json_change(gv_opts *opt, int i, int j, out_buf *ob)
+{
+    static const char *what[] = { NULL, "added", "removed", "changed" };
+
+    if (!opt->diff || !opt->diff[i] || !opt->diff[i][j]) return;
+    out_write(",\"change\":\"", 11, ob);
+    out_write(what[(int)opt->diff[i][j]], strlen(what[(int)opt->diff[i][j]]), ob);
+    out_write("\"", 1, ob);
+}
+
+/* --emit json: the model, with the node ids used in the gv output */
+int render_json(node **table, gv_opts *opt, out_buf *ob)
+{
+    char **rel_id = gv_rel_ids(table);
+    char card[8];
+    name_index by_name;
+    int i, j, n = 0;
+
+    if (index_tables(table, &by_name) < 0) {
+        for (i=0; table[i]; i++)
+            free(rel_id[i]);
+        free(rel_id);
+        return -1;
+    }
+
+    out_write("{\"tables\":[", 11, ob);
+    for (i=0; table[i]; i++) {
+        if (table[i][0].type != TB_SPEC) continue;
+        if (n++) out_write(",", 1, ob);
+        out_write("\n{\"name\":", 9, ob);
+        json_str(table[i][0].name, ob);
+        out_write(",\"id\":", 6, ob);
+        json_str(table[i][0].uname, ob);
+        json_change(opt, i, 0, ob);
+        out_write(",\"columns\":[", 12, ob);
+        for (j=1; table[i][j].name; j++) {
+            out_write(j > 1 ? ",{\"name\":" : "{\"name\":", j > 1 ? 9 : 8, ob);
+            json_str(table[i][j].name, ob);
+            out_write(",\"id\":", 6, ob);
+            json_str(table[i][j].uname, ob);
+            json_change(opt, i, j, ob);
+            out_write("}", 1, ob);
+        }
+        out_write("]}", 2, ob);
+    }
+    out_write("],\n\"relationships\":[", 20, ob);
+    for (i=0, n=0; table[i]; i++) {
+        if (table[i][0].type != REL_SPEC) continue;
+        if (n++) out_write(",", 1, ob);
+        out_write("\n{\"name\":", 9, ob);
+        json_str(table[i][2].name, ob);
+        out_write(",\"id\":", 6, ob);
+        json_str(rel_id[i], ob);
+        out_write(",\"from\":", 8, ob);
+        json_str(table[i][0].name, ob);
+        out_write(",\"to\":", 6, ob);
+        json_str(table[i][1].name, ob);
+        snprintf(card, sizeof(card), "%c:%c", table[i][3].from, table[i][3].to);
+        out_write(",\"cardinality\":", 15, ob);
+        json_str(card, ob);
+        if (opt->inferred && opt->inferred[i])
+            out_write(",\"inferred\":true", 16, ob);
+        json_change(opt, i, 0, ob);
+        out_write("}", 1, ob);
+    }
+    out_write("]}\n", 3, ob);
+
+    for (i=0; table[i]; i++)
+        free(rel_id[i]);
+    free(rel_id);
+    nidx_free(&by_name);
+    return 0;
+}
+
+/* --emit: the formats convert can produce, each from the same view */
+struct emitter_t {
+    const char *name, *ext;
+    int (*render)(node **table, gv_opts *opt, out_buf *ob);
+};
+
+typedef struct emitter_t emitter;
+
+const emitter emitters[] = {
+    { "gv", ".gv", render_gv },
+    { "mermaid", ".mmd", render_mermaid },
+    { "plantuml", ".puml", render_plantuml },
+    { "json", ".json", render_json },
+    { NULL, NULL, NULL }
+};
+
+const emitter *find_emitter(const char *name, size_t len)
+{
+    int k;
+
+    for (k=0; emitters[k].name; k++)
+        if (strlen(emitters[k].name) == len && !strncmp(emitters[k].name, name, len))
+            return &emitters[k];
+    return NULL;
+}
+
+/* what happens between parsing and rendering, as given on the command line */
+struct run_opts_t {
+    char *focus;
+    int depth;
+    bool compact, rank, bundle;
+    int infer;      /* 0, INFER_DRAW or INFER_LINES */
+    struct layout_pins_t *pins;
+    char **diff;    /* --diff marks of the rows passed to convert */
+    const emitter *emit;    /* output format, NULL for gv */
+};
+
+typedef struct run_opts_t run_opts;
+
+node **infer_rels(node **table);
+
+/* --infer=lines: the guesses as description lines instead of a graph */
+void write_rel_lines(node **rels, out_buf *ob)
+{
+    char line[MAX_ERR_LEN*4];
+    int i;
+
+    for (i=0; rels[i]; i++) {
+        int n = snprintf(line, sizeof(line), "%s > %s, %s, %c:%c\n", rels[i][0].name,
+                         rels[i][1].name, rels[i][2].name, rels[i][3].from, rels[i][3].to);
+        if (n > (int)sizeof(line)-1) n = sizeof(line)-1;
+        out_write(line, n, ob);
+    }
+}
+
+/* --focus, --infer, --rank and --bundle passes, then graphviz text into ob */
+int convert(node **table_arr, run_opts *ro, out_buf *ob)
+{
+    gv_opts opt;
+    node **view = table_arr, **guessed = NULL;
+    schema_graph g;
+    int ret = -1, nrows;
+    bool ok = true;
+
+    memset(&opt, 0, sizeof(gv_opts));
+    opt.compact = ro->compact;
+    opt.pins = ro->pins;
+
+    if (ro->focus) {
+        if (build_graph(table_arr, &g) == 0)
+            view = focus_view(table_arr, &g, ro->focus, ro->depth, &opt.elided);
+        else
+            view = NULL;
+        free_graph(&g);
+    }
+    if (view && ro->diff) {
+        int i, k = 0;
+        for (nrows=0; view[nrows]; nrows++)
+            ;
+        opt.diff = calloc(nrows+1, sizeof(char *));
+        if (!opt.diff) hndl_fatal_error("calloc");
+        for (i=0; i<nrows; i++) {   /* the view keeps the order of the rows */
+            while (table_arr[k] != view[i])
+                k++;
+            opt.diff[i] = ro->diff[k];
+        }
+    }
+    if (view && ro->infer) {
+        int i, n;
+        for (nrows=0; view[nrows]; nrows++)
+            ;
+        guessed = infer_rels(view);
+        for (n=0; guessed[n]; n++)
+            ;
+
+        /* the guesses go after everything else */
+        node **more = malloc((nrows+n+1) * sizeof(node *));
+        opt.inferred = calloc(nrows+n+1, sizeof(char));
+        if (!more || !opt.inferred) hndl_fatal_error("malloc");
+        memcpy(more, view, nrows * sizeof(node *));
+        memcpy(more+nrows, guessed, (n+1) * sizeof(node *));
+        for (i=nrows; i<nrows+n; i++)
+            opt.inferred[i] = 1;
+        if (opt.diff) {
+            opt.diff = realloc(opt.diff, (nrows+n+1) * sizeof(char *));
+            if (!opt.diff) hndl_fatal_error("realloc");
+            memset(opt.diff+nrows, 0, (n+1) * sizeof(char *));
+        }
+        if (view != table_arr)
+            free(view);
+        view = more;
+    }
+    if (view && ro->infer == INFER_LINES) {
+        write_rel_lines(guessed, ob);
+        ret = 0;
+        ok = false;
+    }
+    if (view && ok && (ro->rank || ro->bundle)) {
+        for (nrows=0; view[nrows]; nrows++)
+            ;
+        if (build_graph(view, &g) == 0) {
+            if (ro->rank)
+                rank_tables(&g, nrows, &opt.layer, &opt.back);
+            if (ro->bundle)
+                bundle_rels(&g, nrows, &opt.bundle_lead, &opt.bundle_next);
+        }
+        else
+            ok = false;
+        free_graph(&g);
+    }
+    if (view && ok)
+        ret = ro->emit ? ro->emit->render(view, &opt, ob) : render_gv(view, &opt, ob);
+
+    if (view && view != table_arr)
+        free(view);
+    if (guessed)
+        freemem(guessed);
+    free(opt.elided);
+    free(opt.layer);
+    free(opt.back);
+    free(opt.bundle_lead);
+    free(opt.bundle_next);
+    free(opt.inferred);
+    free(opt.diff);
+    return ret;
+}
+
+/* ask before replacing outfile, unless told not to. true to go ahead */
+bool may_overwrite(const char *outfile, bool force)
+{
+#ifndef __gui
+    if (force || !strcmp(outfile, "-"))
+        return true;
+
+#ifdef __linux
+    if ( !access(outfile, F_OK) ) {
+        char r = 0;
+        printf("File: %s exists. Overwrite? (y/n): ", outfile);
+        fflush(stdout);
+        /* a piped answer (echo y | quickerd ...) still counts; with none left, say how */
+        if (scanf(" %c", &r) != 1) {
+            fprintf(stderr, "\nNo answer on stdin. Use -f to overwrite.\n");
+            return false;
+        }
+        if (r != 'y')
+            return false;
+    }
+#elif _WIN32
+    DWORD dwAttrib = GetFileAttributes(outfile);
+    if (dwAttrib != INVALID_FILE_ATTRIBUTES && 
+        !(dwAttrib & FILE_ATTRIBUTE_DIRECTORY)) {
+        char r = 0;
+        printf("File: %s exists. Overwrite? (y/n): ", outfile);
+        scanf("%c", &r);
+        if (r != 'y')
+            return false;
+    }
+#endif
+
+#endif
+    return true;
+}
+
+/* returns 0 once outfile holds the complete graph, -1 otherwise */
+int write_gv_output(node **table, char *outfile, gv_opts *opt)
+{
+    out_buf ob = { NULL, 0, 0 };
+    int ret = -1;
+
+    if (!may_overwrite(outfile, opt->force))
+        return -1;
+
+    if (render_gv(table, opt, &ob) == 0)
+        ret = commit_output(outfile, ob.data, ob.len);
+
+    free(ob.data);
+    return ret;
+}
+
+void freemem(node **table)
+{
+    int i, j;
+    for (i=0; table[i]; i++) {
+        for (j=0; table[i][j].name; j++) {
+            free(table[i][j].name);
+            free(table[i][j].uname);
+            table[i][j].name = NULL;
+        }
+        free(table[i]);
+    }
+    free(table);
+}
+
+/*
+ * --check support. strings that have to outlive a line go into a pool of
+ * chunks that never move; each chunk starts with a link to the previous one.
+ */
+struct str_pool_t {
+    char *chunk;
+    size_t used, size;
+};
+
+typedef struct str_pool_t str_pool;
+
+char *pool_strndup(str_pool *sp, const char *s, size_t n)
+{
+    if (!sp->chunk || sp->used + n + 1 > sp->size) {
+        size_t sz = sizeof(char *) + n + 1;
+        if (sz < POOL_CHUNK) sz = POOL_CHUNK;
+
+        char *c = malloc(sz);
+        if (!c) hndl_fatal_error("malloc");
+        *(char **)c = sp->chunk;
+        sp->chunk = c;
+        sp->used = sizeof(char *);
+        sp->size = sz;
+    }
+
+    char *d = sp->chunk + sp->used;
+    memcpy(d, s, n);
+    d[n] = 0;
+    sp->used += n+1;
+    return d;
+}
+
+void pool_free(str_pool *sp)
+{
+    while (sp->chunk) {
+        char *prev = *(char **)sp->chunk;
+        free(sp->chunk);
+        sp->chunk = prev;
+    }
+}
+
+/*
+ * --infer: relationships the description doesn't state, guessed from
+ * column names. a column named like the key (first column) of another
+ * table refers to it (employee.dpt_id -> dept), tables whose keys share
+ * a name are one to one (employee.eid, salary.eid), and <table>_id or
+ * <table>Id refers to <table> or <table>s. a key named just "id" says
+ * nothing and is only matched the last way. tables and columns are
+ * hashed once by lowercased name and joined, so the pass is linear in
+ * the number of columns. returns the new relationship rows.
+ */
+struct infer_ctx_t {
+    node **out;
+    int n, alloc;
+    long long *pairs;   /* table pairs related already, either way */
+    int psize;
+};
+
+/* false when a and b are related already */
+bool infer_pair(struct infer_ctx_t *ic, int a, int b)
+{
+    long long key = a < b ? ((long long)a << 32) | b : ((long long)b << 32) | a;
+    int slot = (int)(((unsigned long long)key * 0x9E3779B97F4A7C15ULL) >> 40) & (ic->psize-1);
+
+    while (ic->pairs[slot] != -1) {
+        if (ic->pairs[slot] == key)
+            return false;
+        slot = (slot+1) & (ic->psize-1);
+    }
+    ic->pairs[slot] = key;
+    return true;
+}
+
+void infer_add(struct infer_ctx_t *ic, node **table, int src, int dst, const char *col, const char *card)
+{
+    node *row = calloc(5, sizeof(node));
+    const char *name[4] = { table[src][0].name, table[dst][0].name, col, card };
+    int k;
+
+    if (!row) hndl_fatal_error("calloc");
+    for (k=0; k<4; k++) {
+        row[k].name = strdup(name[k]);
+        if (!row[k].name) hndl_fatal_error("strdup");
+        row[k].type = REL_SPEC;
+    }
+    row[3].from = card[0];
+    row[3].to = card[2];
+
+    if (ic->n+1 >= ic->alloc) {
+        ic->alloc *= 2;
+        ic->out = realloc(ic->out, ic->alloc * sizeof(node *));
+        if (!ic->out) hndl_fatal_error("realloc");
+    }
+    ic->out[ic->n++] = row;
+}
+
+char *pool_lower(str_pool *sp, const char *s, size_t n)
+{
+    char *low = pool_strndup(sp, s, n);
+    char *p;
+
+    for (p = low; *p; p++)
+        *p = tolower((unsigned char)*p);
+    return low;
+}
+
+node **infer_rels(node **table)
+{
+    struct infer_ctx_t ic;
+    str_pool pool = { NULL, 0, 0 };
+    name_index tables, keys;
+    int nrows, ncols = 0, i, j;
+
+    for (nrows=0; table[nrows]; nrows++)
+        for (j=0; table[nrows][j].name; j++)
+            ncols++;
+
+    ic.n = 0;
+    ic.alloc = MEM_CHUNK;
+    ic.out = malloc(ic.alloc * sizeof(node *));
+    for (ic.psize = MEM_CHUNK; ic.psize < (ncols + nrows)*2; ic.psize <<= 1)
+        ;
+    ic.pairs = malloc(ic.psize * sizeof(long long));
+    if (!ic.out || !ic.pairs) hndl_fatal_error("malloc");
+    for (i=0; i<ic.psize; i++)
+        ic.pairs[i] = -1;
+
+    /* tables by name, and by the name of their key */
+    nidx_init(&tables, nrows);
+    nidx_init(&keys, nrows);
+    for (i=0; i<nrows; i++) {
+        if (table[i][0].type != TB_SPEC) continue;
+        nidx_insert(&tables, pool_lower(&pool, table[i][0].name, strlen(table[i][0].name)), i);
+    }
+    for (i=0; i<nrows; i++) {
+        if (table[i][0].type != REL_SPEC) continue;
+        int s = nidx_lookup(&tables, pool_lower(&pool, table[i][0].name, strlen(table[i][0].name)));
+        int d = nidx_lookup(&tables, pool_lower(&pool, table[i][1].name, strlen(table[i][1].name)));
+        if (s >= 0 && d >= 0)
+            infer_pair(&ic, s, d);
+    }
+    for (i=0; i<nrows; i++) {
+        if (table[i][0].type != TB_SPEC || !table[i][1].name) continue;
+        char *key = pool_lower(&pool, table[i][1].name, strlen(table[i][1].name));
+        if (!strcmp(key, "id")) continue;
+
+        int home = nidx_insert(&keys, key, i);
+        if (home >= 0 && home != i && infer_pair(&ic, home, i))
+            infer_add(&ic, table, home, i, table[i][1].name, "1:1");
+    }
+
+    /* the join: every other column against both indexes */
+    for (i=0; i<nrows; i++) {
+        if (table[i][0].type != TB_SPEC) continue;
+
+        for (j=1; table[i][j].name; j++) {
+            size_t len = strlen(table[i][j].name);
+            char *col = pool_lower(&pool, table[i][j].name, len);
+            int to = nidx_lookup(&keys, col);
+
+            if (to == i)
+                to = -1;    /* its own key */
+            if (to >= 0 && j == 1)
+                continue;   /* a key, paired above */
+            if (to < 0 && len > 2 && !strcmp(col+len-2, "id")) {
+                /* dept_id, deptId -> dept or depts */
+                len -= 2;
+                if (col[len-1] == '_') len--;
+                if (!len) continue;
+                col[len] = 0;
+                to = nidx_lookup(&tables, col);
+                if (to < 0) {
+                    char *plural = pool_strndup(&pool, col, len+1);
+                    plural[len] = 's';
+                    to = nidx_lookup(&tables, plural);
+                }
+            }
+            if (to >= 0 && to != i && infer_pair(&ic, i, to))
+                infer_add(&ic, table, i, to, table[i][j].name, "m:1");
+        }
+    }
+
+    ic.out[ic.n] = NULL;
+    nidx_free(&tables);
+    nidx_free(&keys);
+    pool_free(&pool);
+    free(ic.pairs);
+    return ic.out;
+}
+
+/* the file's bytes without copying them where possible */
+char *map_file(const char *infile, size_t *len)
+{
+#ifdef __linux
+    int fd = open(infile, O_RDONLY);
+    struct stat sb;
+
+    if (fd < 0) {
+        qerr("Can't read %s: %s\n", infile, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &sb) < 0) hndl_fatal_error("fstat");
+    *len = sb.st_size;
+    if (!*len) {
+        close(fd);
+        return "";
+    }
+    char *mem = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem == MAP_FAILED) hndl_fatal_error("mmap");
+    close(fd);
+    return mem;
+#else
+    char *mem = read_file_into_mem(infile);
+    *len = mem ? strchr(mem, EOF) - mem : 0;
+    return mem;
+#endif
+}
+
+void unmap_file(char *mem, size_t len)
+{
+#ifdef __linux
+    if (len) munmap(mem, len);
+#else
+    free(mem);
+#endif
+}
+
+/* [s, e) without surrounding spaces, as chop_leadntrail would leave it */
+const char *trim_span(const char *s, const char *e, size_t *n)
+{
+    while (s < e && *s == ' ') s++;
+    while (e > s && e[-1] == ' ') e--;
+    *n = e - s;
+    return s;
+}
+
+struct check_ref_t {
+    char *name;
+    const char *file;
+    int line;
+};
+
+/* grow a check_ref_t array by doubling */
+struct check_ref_t *push_ref(struct check_ref_t *arr, int *n, int *alloc, char *name,
+                             const char *file, int line)
+{
+    if (*n == *alloc) {
+        *alloc = *alloc ? *alloc*2 : MEM_CHUNK;
+        arr = realloc(arr, *alloc * sizeof(struct check_ref_t));
+        if (!arr) hndl_fatal_error("realloc");
+    }
+    arr[*n].name = name;
+    arr[*n].file = file;
+    arr[(*n)++].line = line;
+    return arr;
+}
+
+/* what --check knows so far, across a description and its includes */
+struct check_state_t {
+    str_pool pool;
+    name_index vars, tables, files;
+    struct check_ref_t *var_def, *tb_def, *rel_use;
+    int nvar, avar, ntb, atb, nrel, arel;
+    int errors;
+};
+
+void check_file(const char *infile, struct check_state_t *cs);
+
+void check_include(const char *infile, int line_no, const char *line, struct check_state_t *cs)
+{
+    const char *inc = line + strlen("include");
+    size_t nlen;
+
+    while (*inc == ' ')
+        inc++;
+    inc = trim_span(inc, inc + strlen(inc), &nlen);
+
+    char *path = canonical_path(include_path(infile, pool_strndup(&cs->pool, inc, nlen)));
+    char *key = pool_strndup(&cs->pool, path, strlen(path));
+    free(path);
 
+    if (nidx_insert(&cs->files, key, 0) >= 0)
+        return;
+    if (file_usable(key) < 0) {
+        fprintf(stderr, "%s:%d: can't read included file %s\n", infile, line_no, key);
+        cs->errors++;
+        return;
+    }
+    check_file(key, cs);
+}
+
+/* one file of check_content, included ones in place of their include line */
+void check_file(const char *infile, struct check_state_t *cs)
+{
+    size_t len;
+    char *mem = map_file(infile, &len);
+    char *p = mem, *end = mem + len;
+    int line_no = 1;
+
+    if (!mem) {
+        cs->errors++;
+        return;
+    }
+
+    size_t cap = OUTBUFF_CHUNK;
+    char *line = malloc(cap);
+    if (!line) hndl_fatal_error("malloc");
+
+    while (p < end) {
+        /* same line breaking as getline_from_mem */
+        char *s = p;
+        p += line_span(p, end);
+        size_t n = p - s;
+        bool newline = (p < end && *p == '\n');
+
+        if (!n && p < end && *p == EOF) break;
+        if (p < end && !newline && *p != '\r') {
+            fprintf(stderr, "%s:%d: byte 0x%02x is neither printable ASCII nor part of a UTF-8 character\n",
+                    infile, line_no, (unsigned char)*p);
+            cs->errors++;
+        }
+        p++;
+
+        if (!n || *s == '#') {
+            if (newline) line_no++;
+            continue;
+        }
+        if (n+1 > cap) {
+            while (n+1 > cap) cap *= 2;
+            line = realloc(line, cap);
+            if (!line) hndl_fatal_error("realloc");
+        }
+        memcpy(line, s, n);
+        line[n] = 0;
+
+        const char *name;
+        size_t nlen;
+
+        /* each form needs its separator, skip the regexes that can't match */
+        if ( strchr(line, ':') && !strchr(line, '>') && handle_regex(line, reg_var_decl, 0) ) {
+            char *colon = strchr(line, ':');
+            name = trim_span(line, colon, &nlen);
+            char *key = pool_strndup(&cs->pool, name, nlen);
+            name = trim_span(colon+1, line+n, &nlen);
+            char *val = pool_strndup(&cs->pool, name, nlen);
+
+            int prev = nidx_insert(&cs->vars, key, cs->nvar);
+            if (prev >= 0) {
+                fprintf(stderr, "%s:%d: variable \"%s\" redefined, first defined on line %d",
+                        infile, line_no, key, cs->var_def[prev].line);
+                if (strcmp(cs->var_def[prev].file, infile))
+                    fprintf(stderr, " of %s", cs->var_def[prev].file);
+                fprintf(stderr, "\n");
+                cs->errors++;
             }
-            for (j=1; table[i][j].name; j++) {
-                count += sane_snprintf(&outbuff, &tot_alloc, count, "\"%s\" -- \"%s\";\n",
-                                  table[i][0].uname, table[i][j].uname);
+            else
+                cs->var_def = push_ref(cs->var_def, &cs->nvar, &cs->avar, val, infile, line_no);
+        }
+        else if ( strchr(line, '(') && !strchr(line, '>') && handle_regex(line, reg_table_spec, 0) ) {
+            name = trim_span(line, strchr(line, '('), &nlen);
+            char *tb = pool_strndup(&cs->pool, name, nlen);
+            int v = nidx_lookup(&cs->vars, tb);
+            if (v >= 0) tb = cs->var_def[v].name;
+
+            int prev = nidx_insert(&cs->tables, tb, cs->ntb);
+            if (prev >= 0) {
+                fprintf(stderr, "%s:%d: table \"%s\" already defined on line %d",
+                        infile, line_no, tb, cs->tb_def[prev].line);
+                if (strcmp(cs->tb_def[prev].file, infile))
+                    fprintf(stderr, " of %s", cs->tb_def[prev].file);
+                fprintf(stderr, "\n");
+                cs->errors++;
             }
-            count += sane_snprintf(&outbuff, &tot_alloc, count, "}\n");
-            fwrite(outbuff, 1, count, fp);
-            count = 0;
+            else
+                cs->tb_def = push_ref(cs->tb_def, &cs->ntb, &cs->atb, tb, infile, line_no);
         }
-        else if (table[i][0].type == REL_SPEC) {
-            char *src = get_uname(table, table[i][0].name);
-            char *dst = get_uname(table, table[i][1].name);
-
-            if (src && dst) {
-                count += sane_snprintf(&outbuff, &tot_alloc, count, "\nrel%d [label=\"%s\", shape=diamond];\n",
-                                  rel_indx, table[i][2].name);
-                count += sane_snprintf(&outbuff, &tot_alloc, count, "\"%s\" -- rel%d [headport=n,headlabel=%c,labeldistance=2,color=red];\n",
-                                  src, rel_indx, table[i][3].from);
-                count += sane_snprintf(&outbuff, &tot_alloc, count, "rel%d -- \"%s\" [tailport=s,taillabel=%c,labeldistance=2,color=red];\n",
-                                  rel_indx, dst, table[i][3].to);
-
-                fwrite(outbuff, 1, count, fp);
-                count = 0;
-                rel_indx++;
+        else if ( strchr(line, '>') && handle_regex(line, reg_rel_spec, 0) ) {
+            char *gt = strchr(line, '>');
+            char *comma = strchr(gt, ',');
+            const char *span[2][2] = { { line, gt }, { gt+1, comma } };
+            int k;
+
+            for (k=0; k<2; k++) {
+                name = trim_span(span[k][0], span[k][1], &nlen);
+                char *tb = pool_strndup(&cs->pool, name, nlen);
+                int v = nidx_lookup(&cs->vars, tb);
+                cs->rel_use = push_ref(cs->rel_use, &cs->nrel, &cs->arel,
+                                       v >= 0 ? cs->var_def[v].name : tb, infile, line_no);
             }
-            else { fprintf(stderr, "Unknown table in relationship %d : \"%s\" -> \"%s\"\nTable \"%s\" not defined\n",
-                         rel_indx+1, table[i][0].name, table[i][1].name,
-                         (src ? table[i][1].name : table[i][0].name));
-                    fclose(fp);
-                    free(outbuff);
-                    return;
+        }
+        /* after the others, as in scan_content */
+        else if ( *line == 'i' && handle_regex(line, reg_include, 0) ) {
+            check_include(infile, line_no, line, cs);
+        }
+        else {
+            fprintf(stderr, "%s:%d: wrong syntax\n", infile, line_no);
+            cs->errors++;
+        }
+
+        if (newline) line_no++;
+    }
+
+    free(line);
+    unmap_file(mem, len);
+}
+
+/*
+ * --check: one pass over the file that reports every syntax error,
+ * duplicate table, redefined variable and undefined table (tables may be
+ * used before they are defined, so those are settled at the end). only
+ * names are kept, no tables are built. returns the number of errors.
+ */
+int check_content(const char *infile)
+{
+    struct check_state_t cs;
+    int i;
+
+    memset(&cs, 0, sizeof(cs));
+    nidx_init(&cs.vars, MEM_CHUNK);
+    nidx_init(&cs.tables, OUTBUFF_CHUNK);
+    nidx_init(&cs.files, MEM_CHUNK);
+
+    char *self = canonical_path(include_path(NULL, infile));
+    nidx_insert(&cs.files, pool_strndup(&cs.pool, self, strlen(self)), 0);
+    free(self);
+    check_file(infile, &cs);
+
+    for (i=0; i<cs.nrel; i++) {
+        if (nidx_lookup(&cs.tables, cs.rel_use[i].name) >= 0) continue;
+        fprintf(stderr, "%s:%d: table \"%s\" not defined\n", cs.rel_use[i].file,
+                cs.rel_use[i].line, cs.rel_use[i].name);
+        cs.errors++;
+    }
+    if (cs.errors)
+        fprintf(stderr, "%s: %d error%s\n", infile, cs.errors, cs.errors > 1 ? "s" : "");
+
+    free(cs.var_def);
+    free(cs.tb_def);
+    free(cs.rel_use);
+    nidx_free(&cs.vars);
+    nidx_free(&cs.tables);
+    nidx_free(&cs.files);
+    pool_free(&cs.pool);
+    return cs.errors;
+}
+
+/* --stats report, on stderr so it never mixes with the output */
+void print_stats(struct run_stats_t *st, bool json)
+{
+    struct {
+        const char *phase;
+        long calls;
+        double ns;
+        const char *what;
+        long detail;
+    } row[] = {
+        { "read",       1,                  st->read_ns,     "bytes",     st->read_bytes },
+        { "lines",      st->lines,          st->line_ns,     "utf-8",     st->line_utf8 },
+        { "classify",   st->classify_calls, st->classify_ns, NULL,        0 },
+        { "split",      st->split_calls,    st->split_ns,    NULL,        0 },
+        { "var lookup", st->var_lookups,    -1,              "probes",    st->var_probes },
+        { "get_uname",  st->uname_lookups,  st->uname_ns,    NULL,        0 },
+        { "format",     st->fmt_calls,      st->fmt_ns,      "reallocs",  st->fmt_reallocs },
+        { "write",      st->write_calls,    st->write_ns,    "bytes",     st->write_bytes },
+    };
+    int i, n = sizeof(row) / sizeof(row[0]);
+
+    if (json) {
+        fprintf(stderr, "{\"parse_ms\": %.3f, \"output_ms\": %.3f, \"format_bytes\": %ld, \"phases\": {",
+                st->parse_ns / 1e6, st->output_ns / 1e6, st->fmt_bytes);
+        for (i=0; i<n; i++) {
+            fprintf(stderr, "%s\"%s\": {\"calls\": %ld", i ? ", " : "", row[i].phase, row[i].calls);
+            if (row[i].ns >= 0)     /* not timed when too cheap to measure */
+                fprintf(stderr, ", \"ms\": %.3f", row[i].ns / 1e6);
+            if (row[i].what)
+                fprintf(stderr, ", \"%s\": %ld", row[i].what, row[i].detail);
+            fprintf(stderr, "}");
+        }
+        fprintf(stderr, "}}\n");
+        return;
+    }
+
+    fprintf(stderr, "%-12s %12s %12s   %s\n", "phase", "calls", "ms", "");
+    for (i=0; i<n; i++) {
+        if (row[i].ns >= 0)
+            fprintf(stderr, "%-12s %12ld %12.3f", row[i].phase, row[i].calls, row[i].ns / 1e6);
+        else
+            fprintf(stderr, "%-12s %12ld %12s", row[i].phase, row[i].calls, "-");
+        if (row[i].what)
+            fprintf(stderr, "   %ld %s", row[i].detail, row[i].what);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "%-12s %12s %12.3f\n", "parse total", "", st->parse_ns / 1e6);
+    fprintf(stderr, "%-12s %12s %12.3f   %ld bytes formatted\n", "output total", "", st->output_ns / 1e6, st->fmt_bytes);
+}
+
+#ifdef __linux
+/*
+ * --serve: convert descriptions sent over a unix socket. a request is a
+ * 4 byte big endian length followed by the description text; the answer
+ * is a 4 byte status (0 ok, 1 error), a 4 byte length and then the graph
+ * or the error messages. one event loop does all socket io, a pool of
+ * workers converts, and answers are kept for repeated descriptions.
+ */
+struct serve_conn_t {
+    int fd;
+    out_buf in, out;
+    size_t out_off;
+    bool busy, eof;
+};
+
+struct serve_job_t {
+    struct serve_conn_t *conn;
+    char *text;
+    size_t len;
+    out_buf resp;
+    struct serve_job_t *next;
+};
+
+struct serve_cache_ent_t {
+    unsigned long hash;
+    char *text, *resp;
+    size_t len, rlen;
+};
+
+struct server_t {
+    run_opts *ro;
+    int ep, wake;   /* epoll, and the eventfd workers use to wake it */
+    pthread_mutex_t lock;
+    pthread_cond_t more;
+    struct serve_job_t *todo, *todo_tail, *done;
+    bool stop;
+    pthread_mutex_t cache_lock;
+    struct serve_cache_ent_t cache[SERVE_CACHE];
+};
+
+volatile sig_atomic_t serve_stop = 0;
+
+void serve_signal(int sig)
+{
+    serve_stop = 1;
+}
+
+unsigned long hash_mem(const char *p, size_t len)
+{
+    unsigned long hash = 5381;
+    while (len--)
+        hash = ((hash << 5) + hash) + (unsigned char)*p++;
+    return hash;
+}
+
+void put_be32(char *p, unsigned long v)
+{
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+unsigned long get_be32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return ((unsigned long)u[0] << 24) | (u[1] << 16) | (u[2] << 8) | u[3];
+}
+
+void serve_reply(out_buf *resp, int status, const char *data, size_t len)
+{
+    char head[8];
+    put_be32(head, status);
+    put_be32(head+4, len);
+    out_write(head, 8, resp);
+    out_write(data, len, resp);
+}
+
+/* runs on a worker */
+void serve_convert(struct server_t *sv, struct serve_job_t *job)
+{
+    unsigned long h = hash_mem(job->text, job->len);
+    struct serve_cache_ent_t *ent = &sv->cache[h % SERVE_CACHE];
+
+    pthread_mutex_lock(&sv->cache_lock);
+    if (ent->text && ent->hash == h && ent->len == job->len && !memcmp(ent->text, job->text, job->len)) {
+        serve_reply(&job->resp, 0, ent->resp, ent->rlen);
+        pthread_mutex_unlock(&sv->cache_lock);
+        return;
+    }
+    pthread_mutex_unlock(&sv->cache_lock);
+
+    /* parse_content wants the read_file_into_mem layout */
+    char *mem = malloc(job->len+2+MEM_PAD);
+    if (!mem) hndl_fatal_error("malloc");
+    memcpy(mem, job->text, job->len);
+    mem[job->len] = EOF;
+    memset(mem+job->len+1, 0, MEM_PAD+1);
+
+    out_buf gv = { NULL, 0, 0 }, err = { NULL, 0, 0 };
+    int status = 1;
+
+    err_sink = &err;
+    node **table_arr = parse_content(mem);
+    free(mem);
+    if (table_arr) {
+        if (convert(table_arr, sv->ro, &gv) == 0)
+            status = 0;
+        freemem(table_arr);
+    }
+    else if (!err.len)
+        qerr("No tables in description\n");
+    err_sink = NULL;
+
+    if (status) {
+        serve_reply(&job->resp, 1, err.data, err.len);
+    }
+    else {
+        serve_reply(&job->resp, 0, gv.data, gv.len);
+
+        pthread_mutex_lock(&sv->cache_lock);
+        free(ent->text);
+        free(ent->resp);
+        ent->hash = h;
+        ent->text = malloc(job->len);
+        ent->resp = malloc(gv.len);
+        if (!ent->text || !ent->resp) hndl_fatal_error("malloc");
+        memcpy(ent->text, job->text, job->len);
+        memcpy(ent->resp, gv.data, gv.len);
+        ent->len = job->len;
+        ent->rlen = gv.len;
+        pthread_mutex_unlock(&sv->cache_lock);
+    }
+
+    free(gv.data);
+    free(err.data);
+}
+
+void *serve_worker(void *arg)
+{
+    struct server_t *sv = arg;
+    uint64_t one = 1;
+
+    for (;;) {
+        pthread_mutex_lock(&sv->lock);
+        while (!sv->todo && !sv->stop)
+            pthread_cond_wait(&sv->more, &sv->lock);
+        if (!sv->todo) {
+            pthread_mutex_unlock(&sv->lock);
+            break;
+        }
+        struct serve_job_t *job = sv->todo;
+        sv->todo = job->next;
+        pthread_mutex_unlock(&sv->lock);
+
+        serve_convert(sv, job);
+
+        pthread_mutex_lock(&sv->lock);
+        job->next = sv->done;
+        sv->done = job;
+        pthread_mutex_unlock(&sv->lock);
+        if (write(sv->wake, &one, sizeof(one)) < 0)
+            perror("eventfd");
+    }
+
+    return NULL;
+}
+
+void serve_watch(struct server_t *sv, struct serve_conn_t *c)
+{
+    struct epoll_event ev;
+    /* nothing more is read once the peer is done or was cut off */
+    ev.events = (c->eof ? 0 : EPOLLIN) | (c->out_off < c->out.len ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(sv->ep, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/* close once the peer is gone and nothing is owed to it */
+bool serve_maybe_close(struct server_t *sv, struct serve_conn_t *c)
+{
+    if (!c->eof || c->busy || c->out_off < c->out.len)
+        return false;
+
+    epoll_ctl(sv->ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->in.data);
+    free(c->out.data);
+    free(c);
+    return true;
+}
+
+/* hand the next complete request of c to the workers */
+void serve_next(struct server_t *sv, struct serve_conn_t *c)
+{
+    if (c->busy || c->in.len < 4)
+        return;
+
+    size_t n = get_be32(c->in.data);
+    if (n > SERVE_MAX_REQUEST) {
+        char msg[] = "Request too large\n";
+        serve_reply(&c->out, 1, msg, strlen(msg));
+        /* the rest of the body would read as new requests */
+        shutdown(c->fd, SHUT_RD);
+        c->in.len = 0;
+        c->eof = true;
+        serve_watch(sv, c);
+        return;
+    }
+    if (c->in.len < 4+n)
+        return;
+
+    struct serve_job_t *job = calloc(1, sizeof(struct serve_job_t));
+    if (!job) hndl_fatal_error("calloc");
+    job->conn = c;
+    job->len = n;
+    job->text = malloc(n+1);
+    if (!job->text) hndl_fatal_error("malloc");
+    memcpy(job->text, c->in.data+4, n);
+    memmove(c->in.data, c->in.data+4+n, c->in.len-4-n);
+    c->in.len -= 4+n;
+    c->busy = true;
+
+    pthread_mutex_lock(&sv->lock);
+    if (sv->todo) sv->todo_tail->next = job;
+    else sv->todo = job;
+    sv->todo_tail = job;
+    pthread_cond_signal(&sv->more);
+    pthread_mutex_unlock(&sv->lock);
+}
+
+int serve(const char *path, run_opts *ro, int nworkers)
+{
+    static struct server_t sv;  /* large, and lives as long as the process */
+    static char listen_tag, wake_tag;
+    struct sockaddr_un addr;
+    int i;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return 1;
+    }
+
+    includes_off = true;
+    warm_regex();
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, serve_signal);
+    signal(SIGTERM, serve_signal);
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (lfd < 0) hndl_fatal_error("socket");
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) hndl_fatal_error("bind");
+    if (listen(lfd, SOMAXCONN) < 0) hndl_fatal_error("listen");
+
+    sv.ro = ro;
+    pthread_mutex_init(&sv.lock, NULL);
+    pthread_mutex_init(&sv.cache_lock, NULL);
+    pthread_cond_init(&sv.more, NULL);
+    sv.wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    sv.ep = epoll_create1(EPOLL_CLOEXEC);
+    if (sv.wake < 0 || sv.ep < 0) hndl_fatal_error("epoll");
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_tag;
+    epoll_ctl(sv.ep, EPOLL_CTL_ADD, lfd, &ev);
+    ev.data.ptr = &wake_tag;
+    epoll_ctl(sv.ep, EPOLL_CTL_ADD, sv.wake, &ev);
+
+    pthread_t *workers = malloc(nworkers * sizeof(pthread_t));
+    if (!workers) hndl_fatal_error("malloc");
+    for (i=0; i<nworkers; i++)
+        if (pthread_create(&workers[i], NULL, serve_worker, &sv))
+            hndl_fatal_error("pthread_create");
+
+    fprintf(stderr, "Serving on %s with %d workers\n", path, nworkers);
+
+    struct epoll_event evs[SERVE_EVENTS];
+    while (!serve_stop) {
+        int n = epoll_wait(sv.ep, evs, SERVE_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            hndl_fatal_error("epoll_wait");
+        }
+
+        for (i=0; i<n; i++) {
+            if (evs[i].data.ptr == &listen_tag) {
+                int fd;
+                while ( (fd = accept(lfd, NULL, NULL)) >= 0 ) {
+                    fcntl(fd, F_SETFL, O_NONBLOCK);
+                    fcntl(fd, F_SETFD, FD_CLOEXEC);
+                    struct serve_conn_t *c = calloc(1, sizeof(struct serve_conn_t));
+                    if (!c) hndl_fatal_error("calloc");
+                    c->fd = fd;
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = c;
+                    epoll_ctl(sv.ep, EPOLL_CTL_ADD, fd, &ev);
+                }
+                continue;
+            }
+
+            if (evs[i].data.ptr == &wake_tag) {
+                uint64_t cnt;
+                if (read(sv.wake, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+                    perror("eventfd");
+
+                pthread_mutex_lock(&sv.lock);
+                struct serve_job_t *job = sv.done;
+                sv.done = NULL;
+                pthread_mutex_unlock(&sv.lock);
+
+                while (job) {
+                    struct serve_job_t *next = job->next;
+                    struct serve_conn_t *c = job->conn;
+
+                    c->busy = false;
+                    out_write(job->resp.data, job->resp.len, &c->out);
+                    free(job->resp.data);
+                    free(job->text);
+                    free(job);
+
+                    serve_next(&sv, c);
+                    serve_watch(&sv, c);
+                    job = next;
+                }
+                continue;
+            }
+
+            struct serve_conn_t *c = evs[i].data.ptr;
+            if (!c->eof && evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                char buff[OUTBUFF_CHUNK*16];
+                ssize_t got;
+                while ( (got = read(c->fd, buff, sizeof(buff))) > 0 )
+                    out_write(buff, got, &c->in);
+                if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    c->eof = true;
+                    if (got < 0)    /* nobody left to answer */
+                        c->out_off = c->out.len;
+                }
+                serve_next(&sv, c);
+            }
+            if (evs[i].events & EPOLLOUT) {
+                while (c->out_off < c->out.len) {
+                    ssize_t put = write(c->fd, c->out.data + c->out_off, c->out.len - c->out_off);
+                    if (put < 0) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK)
+                            c->out_off = c->out.len, c->eof = true;
+                        break;
+                    }
+                    c->out_off += put;
+                }
+                if (c->out_off == c->out.len)
+                    c->out_off = c->out.len = 0;
             }
+            if (!serve_maybe_close(&sv, c))
+                serve_watch(&sv, c);
         }
     }
-    fputc('}', fp); /* brings closure*/
 
-    fclose(fp);
-    free(outbuff);
+    pthread_mutex_lock(&sv.lock);
+    sv.stop = true;
+    pthread_cond_broadcast(&sv.more);
+    pthread_mutex_unlock(&sv.lock);
+    for (i=0; i<nworkers; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    close(lfd);
+    unlink(path);
+    for (i=0; i<SERVE_CACHE; i++) {
+        free(sv.cache[i].text);
+        free(sv.cache[i].resp);
+    }
+    return 0;
 }
+#endif
 
-void freemem(node **table)
+#ifndef QUICKERD_NO_MAIN  /* the benchmark links everything but main */
+
+void usage(const char *prog)
 {
-    int i, j;
-    for (i=0; table[i]; i++) {
-        for (j=0; table[i][j].name; j++) {
-            free(table[i][j].name);
-            free(table[i][j].uname);
-            table[i][j].name = NULL;
+    fprintf(stderr, "Usage: %s [options] <table spce file> <output file>\n", prog);
+    fprintf(stderr, "       %s --check <table spce file>\n", prog);
+    fprintf(stderr, "       %s [options] --diff <old file> <new file> <output file>\n", prog);
+    fprintf(stderr, "       %s [options] --serve <socket>\n", prog);
+    fprintf(stderr, "Supply table spec file and output file names.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --check             only report every error in the file, write nothing\n");
+    fprintf(stderr, "  -f                  overwrite the output file without asking; '-' as output is stdout\n");
+    fprintf(stderr, "  --sql               input is an SQL dump (CREATE TABLE, FOREIGN KEY); '-' is stdin\n");
+    fprintf(stderr, "  --focus t1[,t2...]  only emit tables near the given ones\n");
+    fprintf(stderr, "  --depth k           relationship hops kept around --focus (default 1)\n");
+    fprintf(stderr, "  --compact           smaller output using short node ids and edge sets\n");
+    fprintf(stderr, "  --infer[=lines]     guess missing relationships from column names; draw them\n"
+                    "                      dashed, or with =lines write them as description lines\n");
+    fprintf(stderr, "  --diff              draw what was added, removed or changed between two versions\n");
+    fprintf(stderr, "  --changed           with --diff, leave out tables more than --depth hops from a change\n");
+    fprintf(stderr, "  --emit f1[,f2...]   write each of gv, mermaid, plantuml, json; the output file\n"
+                    "                      name gets the extension of each format\n");
+    fprintf(stderr, "  --rank              pre-rank tables along relationship direction\n");
+    fprintf(stderr, "  --bundle            one node for all relationships between the same tables\n");
+    fprintf(stderr, "  --layout-from file  keep node positions from dot -Tplain/-Txdot output\n");
+    fprintf(stderr, "  --stats[=json]      report time and counts per phase on stderr\n");
+    fprintf(stderr, "  --serve socket      convert descriptions sent to a unix socket, see README\n");
+    fprintf(stderr, "  --workers n         conversions --serve runs at once (default %d)\n", SERVE_WORKERS);
+}
+
+/* --emit: one conversion per format, each on a thread of its own */
+struct emit_job_t {
+    node **table;
+    run_opts ro;
+    out_buf ob, err;
+    int ret;
+};
+
+void *emit_worker(void *arg)
+{
+    struct emit_job_t *job = arg;
+
+    err_sink = &job->err;
+    job->ret = convert(job->table, &job->ro, &job->ob);
+    err_sink = NULL;
+    return NULL;
+}
+
+/* outs[k] gets the output of emit[k]. -1 if any of them failed */
+int emit_all(node **table, run_opts *ro, const emitter **emit, int n, out_buf *outs)
+{
+    struct emit_job_t *jobs = calloc(n, sizeof(struct emit_job_t));
+    int k, ret = 0;
+
+    if (!jobs) hndl_fatal_error("calloc");
+    for (k=0; k<n; k++) {
+        jobs[k].table = table;
+        jobs[k].ro = *ro;
+        jobs[k].ro.emit = emit[k];
+    }
+
+#ifdef __linux
+    /* the --stats counters are not shared between threads */
+    if (n > 1 && !qstats) {
+        pthread_t *tid = malloc(n * sizeof(pthread_t));
+        bool *started = calloc(n, sizeof(bool));
+        if (!tid || !started) hndl_fatal_error("malloc");
+        for (k=1; k<n; k++)
+            started[k] = !pthread_create(&tid[k], NULL, emit_worker, &jobs[k]);
+        emit_worker(&jobs[0]);
+        for (k=1; k<n; k++) {
+            if (started[k])
+                pthread_join(tid[k], NULL);
+            else
+                emit_worker(&jobs[k]);
         }
-        free(table[i]);
+        free(tid);
+        free(started);
     }
-    free(table);
+    else
+#endif
+        for (k=0; k<n; k++)
+            emit_worker(&jobs[k]);
+
+    /* the formats see the same model, so report its errors once */
+    for (k=0; k<n; k++) {
+        if (jobs[k].ret < 0 && !ret) {
+            fprintf(stderr, "%.*s", (int)jobs[k].err.len, jobs[k].err.data ? jobs[k].err.data : "");
+            ret = -1;
+        }
+        free(jobs[k].err.data);
+        outs[k] = jobs[k].ob;
+    }
+    free(jobs);
+    return ret;
+}
+
+/* out.gv, out.json... from the output name given to --emit; '-' stays stdout */
+char *emit_path(const char *outfile, const char *ext)
+{
+    size_t len = strlen(outfile), elen = strlen(ext);
+    char *path = malloc(len + elen + 1);
+
+    if (!path) hndl_fatal_error("malloc");
+    strcpy(path, outfile);
+    if (strcmp(outfile, "-") && (len < elen || strcmp(outfile + len - elen, ext)))
+        strcpy(path + len, ext);
+    return path;
+}
+
+/* a description, or an SQL dump with --sql */
+node **read_model(const char *file, bool sql)
+{
+    node **table_arr;
+
+    if (sql) {
+        STAT_START(t_parse);
+        table_arr = import_sql(file);
+        STAT_STOP(parse_ns, t_parse);
+    }
+    else {
+        char *mem = read_file_into_mem(file);
+        if (!mem) return NULL;
+        STAT_START(t_parse);
+        table_arr = parse_description(mem, file);
+        STAT_STOP(parse_ns, t_parse);
+        free(mem);
+    }
+    return table_arr;
 }
 
 int main(int argc, char **argv)
 {
     char *infile = NULL;
-    char *outfile = NULL;
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <table spce file> <output file>\n", argv[0]);
-        fprintf(stderr, "Supply table spec file and output file names.\n");
+    char *outfile = NULL, *difffile = NULL;
+    char *layout = NULL, *sock = NULL;
+    run_opts ro = { NULL, 1 };
+    int workers = SERVE_WORKERS;
+    bool stats_json = false;
+    bool check = false, force = false, failed = false, sql = false;
+    bool diff = false, changed = false, extra = false;
+    const emitter *emit[sizeof(emitters) / sizeof(emitters[0])];
+    int nemit = 0, i;
+
+    for (i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--focus") && i+1 < argc)
+            ro.focus = argv[++i];
+        else if (!strcmp(argv[i], "--depth") && i+1 < argc)
+            ro.depth = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--compact"))
+            ro.compact = true;
+        else if (!strcmp(argv[i], "--rank"))
+            ro.rank = true;
+        else if (!strcmp(argv[i], "--check"))
+            check = true;
+        else if (!strcmp(argv[i], "--sql"))
+            sql = true;
+        else if (!strcmp(argv[i], "--infer"))
+            ro.infer = INFER_DRAW;
+        else if (!strcmp(argv[i], "--infer=lines"))
+            ro.infer = INFER_LINES;
+        else if (!strcmp(argv[i], "--emit") && i+1 < argc) {
+            const char *p = argv[++i], *end;
+            for (; *p; p = *end ? end+1 : end) {
+                end = strchr(p, ',');
+                if (!end) end = p + strlen(p);
+                const emitter *em = find_emitter(p, end - p);
+                int k;
+                if (!em) {
+                    fprintf(stderr, "Unknown output format \"%.*s\" for --emit\n", (int)(end - p), p);
+                    return 1;
+                }
+                for (k=0; k<nemit && emit[k] != em; k++)
+                    ;
+                if (k == nemit)
+                    emit[nemit++] = em;
+            }
+        }
+        else if (!strcmp(argv[i], "--diff"))
+            diff = true;
+        else if (!strcmp(argv[i], "--changed"))
+            changed = true;
+        else if (!strcmp(argv[i], "-f"))
+            force = true;
+        else if (!strcmp(argv[i], "--bundle"))
+            ro.bundle = true;
+        else if (!strcmp(argv[i], "--layout-from") && i+1 < argc)
+            layout = argv[++i];
+        else if (!strcmp(argv[i], "--serve") && i+1 < argc)
+            sock = argv[++i];
+        else if (!strcmp(argv[i], "--workers") && i+1 < argc)
+            workers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--stats") || !strcmp(argv[i], "--stats=json")) {
+            static struct run_stats_t st;
+            qstats = &st;
+            stats_json = (argv[i][7] == '=');
+        }
+        else if (argv[i][0] == '-' && argv[i][1]) {
+            usage(argv[0]);
+            return 1;
+        }
+        else if (!infile)
+            infile = argv[i];
+        else if (!outfile)
+            outfile = argv[i];
+        else if (!difffile)
+            difffile = argv[i];
+        else
+            extra = true;
+    }
+    if (check && infile && !outfile && !sql)
+        return check_content(infile) ? 1 : 0;
+    if (sock && !infile && !layout && !nemit && workers > 0 && ro.depth >= 0) {
+#ifdef __linux
+        qstats = NULL;  /* the counters are not shared between threads */
+        return serve(sock, &ro, workers);
+#else
+        fprintf(stderr, "--serve is only supported on linux\n");
+        return 1;
+#endif
+    }
+    /* --check writes nothing, so it takes no output file */
+    if (!infile || !outfile || sock || check || ro.depth < 0 ||
+        extra || (diff ? !difffile || ro.focus : difffile != NULL) || (changed && !diff) ||
+        (nemit && ro.infer == INFER_LINES)) {
+        usage(argv[0]);
         return 1;
     }
-    else {
-        infile = argv[1];
-        outfile = argv[2];
+    if (layout && ro.compact) {
+        fprintf(stderr, "--layout-from needs the regular node ids, it can't be used with --compact\n");
+        return 1;
     }
 
-    char *mem = read_file_into_mem(infile);
-    node **table_arr = parse_content(mem);
-    free(mem);
+    node **table_arr = read_model(infile, sql), **old = NULL, **new = NULL;
+    if (diff) {
+        /* old new out: both versions in one model, drawn as usual */
+        old = table_arr;
+        new = old ? read_model(outfile, sql) : NULL;
+        table_arr = new ? diff_model(old, new, &ro.diff) : NULL;
+        outfile = difffile;
+        if (table_arr && changed)
+            ro.focus = diff_focus(table_arr, ro.diff);
+    }
    
     if (table_arr) {
+        out_buf ob = { NULL, 0, 0 };
         /*
         int i, j;
         for (i=0; table_arr[i]; i++) {
@@ -603,10 +4635,61 @@ int main(int argc, char **argv)
             }
         }
         */
-        write_gv_output(table_arr, outfile);
-        freemem(table_arr);
+        layout_pins pins;
+        if (layout) {
+            int npins = load_layout(layout, &pins);
+            if (npins < 0)
+                failed = true;
+            else if (!npins)
+                fprintf(stderr, "No node positions found in %s\n", layout);
+            ro.pins = &pins;
+        }
+        STAT_START(t_out);
+        if (nemit) {
+            /* every file is written only once all formats are done */
+            out_buf outs[sizeof(emitters) / sizeof(emitters[0])];
+            char *paths[sizeof(emitters) / sizeof(emitters[0])];
+            int k;
+            for (k=0; k<nemit; k++) {
+                paths[k] = emit_path(outfile, emit[k]->ext);
+                if (!failed && !may_overwrite(paths[k], force))
+                    failed = true;
+            }
+            if (!failed && emit_all(table_arr, &ro, emit, nemit, outs) < 0) {
+                failed = true;
+                for (k=0; k<nemit; k++)
+                    free(outs[k].data);
+            }
+            else if (!failed)
+                for (k=0; k<nemit; k++) {
+                    if (!failed && commit_output(paths[k], outs[k].data, outs[k].len) < 0)
+                        failed = true;
+                    free(outs[k].data);
+                }
+            for (k=0; k<nemit; k++)
+                free(paths[k]);
+        }
+        else if (failed || !may_overwrite(outfile, force) || convert(table_arr, &ro, &ob) < 0 ||
+            commit_output(outfile, ob.data, ob.len) < 0)
+            failed = true;
+        STAT_STOP(output_ns, t_out);
+        free(ob.data);
+        if (layout)
+            free_pins(&pins);
+        if (diff) {
+            free_diff(table_arr, ro.diff);
+            if (changed) free(ro.focus);
+        }
+        else
+            freemem(table_arr);
     }
-    else return 1;
+    if (old) freemem(old);
+    if (new) freemem(new);
+    if (qstats)
+        print_stats(qstats, stats_json);
+    if (!table_arr || failed) return 1;
     
     return 0;
 }
+
+#endif /* QUICKERD_NO_MAIN */
@@ -0,0 +1,322 @@
+/*
+* run - regression tests for quickerd, run by make test
+* Released under           :: GPL v3
+*
+* usage: run [-q quickerd]
+*
+* every test writes its inputs to a scratch directory, runs quickerd on
+* them and looks at the output and exit status. exits 1 if any fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+char *quickerd = "./quickerd";
+char dir[] = "/tmp/quickerd_test.XXXXXX";
+
+/* dir/name, in one of a few rotating buffers */
+char *in_dir(const char *name)
+{
+    static char paths[4][512];
+    static int next;
+    char *p = paths[next++ % 4];
+
+    snprintf(p, sizeof(paths[0]), "%s/%s", dir, name);
+    return p;
+}
+
+void write_file(const char *path, const char *text)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp) { perror(path); exit(1); }
+    fputs(text, fp);
+    fclose(fp);
+}
+
+/* the file's bytes, NUL terminated; "" if it can't be read */
+char *read_file(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char *data;
+    long n;
+
+    if (!fp) return strdup("");
+    fseek(fp, 0, SEEK_END);
+    n = ftell(fp);
+    rewind(fp);
+    data = calloc(1, n+1);
+    if (!data) { perror("calloc"); exit(1); }
+    n = fread(data, 1, n, fp);
+    fclose(fp);
+    return data;
+}
+
+/*
+ * runs argv with stdin from /dev/null, stdout and stderr to out and err
+ * (unless NULL). returns its exit status, -1 if it didn't exit.
+ */
+int run(char **argv, const char *out, const char *err)
+{
+    int status;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) { perror("fork"); exit(1); }
+    if (!pid) {
+        int fd = open("/dev/null", O_RDONLY);
+        if (fd < 0 || dup2(fd, 0) < 0) _exit(127);
+        close(fd);
+        if (out) {
+            fd = open(out, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+            if (fd < 0 || dup2(fd, 1) < 0) _exit(127);
+            close(fd);
+        }
+        if (err) {
+            fd = open(err, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+            if (fd < 0 || dup2(fd, 2) < 0) _exit(127);
+            close(fd);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    if (waitpid(pid, &status, 0) < 0) { perror("waitpid"); exit(1); }
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/* quickerd -f in -, into out. the exit status */
+int convert(const char *in, const char *out, const char *err)
+{
+    char *argv[] = { quickerd, "-f", (char *)in, "-", NULL };
+    return run(argv, out, err);
+}
+
+/* the last line of a description needs no '\n' */
+int no_final_newline(void)
+{
+    write_file(in_dir("nl.txt"), "a (id)\nb (id, name)\na > b, has, 1:m\n");
+    write_file(in_dir("no_nl.txt"), "a (id)\nb (id, name)\na > b, has, 1:m");
+
+    if (convert(in_dir("nl.txt"), in_dir("nl.gv"), NULL) ||
+        convert(in_dir("no_nl.txt"), in_dir("no_nl.gv"), in_dir("no_nl.err")))
+        return 1;
+
+    char *a = read_file(in_dir("nl.gv")), *b = read_file(in_dir("no_nl.gv"));
+    char *err = read_file(in_dir("no_nl.err"));
+    int failed = !*a || strcmp(a, b) || *err;
+    free(a);
+    free(b);
+    free(err);
+    return failed;
+}
+
+/* a table may be called include; a line is only an include if it is nothing else */
+int table_named_include(void)
+{
+    write_file(in_dir("lib.txt"), "t (id)\n");
+    write_file(in_dir("main.txt"), "include (a, b)\ninclude lib.txt\ninclude > t, uses, 1:m\n");
+
+    if (convert(in_dir("main.txt"), in_dir("main.gv"), NULL))
+        return 1;
+
+    char *gv = read_file(in_dir("main.gv"));
+    int failed = !strstr(gv, "\"include\" [label=\"include\"") || !strstr(gv, "\"t\" [label=\"t\"");
+    free(gv);
+    return failed;
+}
+
+/* an include that can't be read is reported where it was included */
+int include_missing(void)
+{
+    write_file(in_dir("main.txt"), "t (id)\ninclude missing.txt\n");
+
+    if (convert(in_dir("main.txt"), in_dir("main.gv"), in_dir("main.err")) != 1)
+        return 1;
+
+    char *err = read_file(in_dir("main.err"));
+    int failed = !strstr(err, "missing.txt, in ") || !strstr(err, "main.txt on line: 2");
+    free(err);
+    return failed;
+}
+
+/* a quickerd --serve on dir/sock, and a connection to it */
+pid_t serve_start(int *fd)
+{
+    struct sockaddr_un addr;
+    struct timespec pause = { 0, 10000000 };
+    int i;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", in_dir("sock"));
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) { perror("fork"); exit(1); }
+    if (!pid) {
+        char *argv[] = { quickerd, "--serve", addr.sun_path, NULL };
+        int null = open("/dev/null", O_WRONLY);
+        if (null < 0 || dup2(null, 1) < 0 || dup2(null, 2) < 0) _exit(127);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    for (i=0; i<500; i++) {
+        *fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (*fd < 0) { perror("socket"); exit(1); }
+        if (!connect(*fd, (struct sockaddr *)&addr, sizeof(addr)))
+            return pid;
+        close(*fd);
+        nanosleep(&pause, NULL);
+    }
+    *fd = -1;
+    return pid;
+}
+
+void serve_stop(pid_t pid, int fd)
+{
+    if (fd >= 0) close(fd);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+void put_be32(char *p, unsigned long v)
+{
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+unsigned long get_be32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return (unsigned long)u[0] << 24 | u[1] << 16 | u[2] << 8 | u[3];
+}
+
+/* everything the server sends until it closes, once our side is shut */
+char *serve_read_all(int fd, size_t *len)
+{
+    size_t cap = 4096;
+    char *data = malloc(cap);
+    ssize_t got;
+
+    if (!data) { perror("malloc"); exit(1); }
+    shutdown(fd, SHUT_WR);
+    *len = 0;
+    while ((got = read(fd, data + *len, cap - *len)) > 0) {
+        *len += got;
+        if (*len == cap && !(data = realloc(data, cap *= 2))) { perror("realloc"); exit(1); }
+    }
+    return data;
+}
+
+/* a request without a final '\n' is answered like the same file on the command line */
+int serve_no_final_newline(void)
+{
+    const char *text = "a (id)\nb (id, name)\na > b, has, 1:m";
+    char head[4];
+    int fd, failed = 1;
+
+    write_file(in_dir("serve.txt"), text);
+    if (convert(in_dir("serve.txt"), in_dir("serve.gv"), NULL))
+        return 1;
+
+    pid_t pid = serve_start(&fd);
+    if (fd >= 0) {
+        size_t len;
+        put_be32(head, strlen(text));
+        if (write(fd, head, 4) == 4 && write(fd, text, strlen(text)) == (ssize_t)strlen(text)) {
+            char *reply = serve_read_all(fd, &len), *gv = read_file(in_dir("serve.gv"));
+            failed = len < 8 || get_be32(reply) != 0 || get_be32(reply+4) != len-8 ||
+                     len-8 != strlen(gv) || memcmp(reply+8, gv, len-8);
+            free(reply);
+            free(gv);
+        }
+    }
+    serve_stop(pid, fd);
+    return failed;
+}
+
+/*
+ * one error for an oversized request, and nothing read from its body.
+ * a good request goes first, so the body keeps arriving while the server
+ * works on it; the body is made of requests that would be answered if
+ * any of it were read as such.
+ */
+int serve_too_large(void)
+{
+    const char good[] = "\0\0\0\6a (id)";
+    size_t n = 10 + 4 + (4 << 20) / 10 * 10, len, i;
+    char *req = malloc(n);
+    int fd, failed = 1;
+
+    if (!req) { perror("malloc"); exit(1); }
+    memcpy(req, good, 10);
+    put_be32(req+10, 0x7FFFFFFF);
+    for (i=14; i<n; i+=10)
+        memcpy(req+i, good, 10);
+    signal(SIGPIPE, SIG_IGN);   /* the server stops reading mid body */
+
+    pid_t pid = serve_start(&fd);
+    if (fd >= 0) {
+        for (i=0; i<n; ) {
+            ssize_t put = write(fd, req+i, n-i);
+            if (put <= 0) break;
+            i += put;
+        }
+        /* the answer to the good request, the error, and nothing else */
+        char *reply = serve_read_all(fd, &len);
+        size_t first = len >= 8 ? 8 + get_be32(reply+4) : len;
+        failed = len < first + 8 || get_be32(reply) != 0 ||
+                 get_be32(reply+first) != 1 || get_be32(reply+first+4) != len-first-8;
+        free(reply);
+    }
+    serve_stop(pid, fd);
+    free(req);
+    return failed;
+}
+
+static const struct {
+    const char *name;
+    int (*test)(void);
+} tests[] = {
+    { "no_final_newline", no_final_newline },
+    { "table_named_include", table_named_include },
+    { "include_missing", include_missing },
+    { "serve_no_final_newline", serve_no_final_newline },
+    { "serve_too_large", serve_too_large },
+};
+
+int main(int argc, char **argv)
+{
+    int i, failed = 0, ntests = sizeof(tests) / sizeof(tests[0]);
+
+    if (argc == 3 && !strcmp(argv[1], "-q"))
+        quickerd = argv[2];
+    else if (argc != 1) {
+        fprintf(stderr, "Usage: %s [-q quickerd]\n", argv[0]);
+        return 1;
+    }
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    for (i=0; i<ntests; i++) {
+        int bad = tests[i].test();
+        printf("%-24s %s\n", tests[i].name, bad ? "FAILED" : "ok");
+        if (bad) failed++;
+    }
+
+    char *argv_rm[] = { "/bin/rm", "-rf", dir, NULL };
+    run(argv_rm, NULL, NULL);
+    if (failed)
+        printf("%d of %d tests failed\n", failed, ntests);
+    return failed ? 1 : 0;
+}